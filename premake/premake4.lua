@@ -83,6 +83,13 @@ project ( name )
     targetextension ( ".exe" )                  --Windows executable type
     links ( "opengl32" )                        --finds the opengl lib file
 
+    --OpenMP for the CPU distance field--------
+    configuration "vs*"
+        buildoptions { "/openmp" }
+    configuration "gmake"
+        buildoptions { "-fopenmp" }
+        linkoptions { "-fopenmp" }
+
     --Debug-----------------------------------
     configuration "Debug"
         flags   { "Symbols" }
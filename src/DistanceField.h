@@ -0,0 +1,220 @@
+#pragma once
+
+#include "Utils.h"
+#include "ShaderConstants.h"
+#include "engine/Buffer.h"
+#include "VoxelTexture.h"
+
+// Distance from every voxel to the nearest occupied one, in texture space, so rays can
+// sphere trace through empty space. Built on the GPU with a jump flood or on the CPU with
+// an exact distance transform, and only rebuilt after the voxels change.
+class DistanceField
+{
+private:
+
+    GLuint seedProgram;
+    GLuint jumpProgram;
+    GLuint resolveProgram;
+    GLuint seedTextures[2];
+    GLuint distanceSampler;
+    VoxelTexture* voxelTexture;
+    UniformRingBuffer* uniformRing;
+    uint builtRevision;
+    bool built;
+
+public:
+
+    enum GenerationType {JUMP_FLOOD_GPU, EXACT_CPU, MAX_GENERATION_TYPES};
+    GenerationType currentGenerationType;
+    GLuint distanceTexture;
+    uint mipLevel;      // voxel mip the field is built from, 0 for full resolution and 1 for half
+    uint gridLength;
+
+    void begin(VoxelTexture* voxelTexture, uint mipLevel, UniformRingBuffer* uniformRing)
+    {
+        this->voxelTexture = voxelTexture;
+        this->mipLevel = mipLevel;
+        this->uniformRing = uniformRing;
+        this->gridLength = voxelTexture->mipMapInfoArray[mipLevel].gridLength;
+        this->currentGenerationType = JUMP_FLOOD_GPU;
+        this->built = false;
+
+        // The field is a conservative bound per texel, so it must not be interpolated
+        glGenSamplers(1, &distanceSampler);
+        Utils::OpenGL::bindSampler(NON_USED_TEXTURE, distanceSampler);
+        glSamplerParameteri(distanceSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glSamplerParameteri(distanceSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glSamplerParameteri(distanceSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(distanceSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(distanceSampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        Utils::OpenGL::bindSampler(DISTANCE_FIELD_BINDING, distanceSampler);
+
+        glActiveTexture(GL_TEXTURE0 + DISTANCE_FIELD_BINDING);
+        glGenTextures(1, &distanceTexture);
+        glBindTexture(GL_TEXTURE_3D, distanceTexture);
+        glTexStorage3D(GL_TEXTURE_3D, 1, GL_R16F, gridLength, gridLength, gridLength);
+
+        // Packed seed positions, ping-ponged between jump flood passes
+        glActiveTexture(GL_TEXTURE0 + NON_USED_TEXTURE);
+        glGenTextures(2, seedTextures);
+        for(uint i = 0; i < 2; i++)
+        {
+            glBindTexture(GL_TEXTURE_3D, seedTextures[i]);
+            glTexStorage3D(GL_TEXTURE_3D, 1, GL_R32UI, gridLength, gridLength, gridLength);
+        }
+
+        // Create shader programs
+        std::string computeShaderSource = SHADER_DIRECTORY + "distanceFieldSeed.comp";
+        seedProgram = Utils::OpenGL::createComputeProgram(computeShaderSource);
+
+        computeShaderSource = SHADER_DIRECTORY + "distanceFieldJump.comp";
+        jumpProgram = Utils::OpenGL::createComputeProgram(computeShaderSource);
+
+        computeShaderSource = SHADER_DIRECTORY + "distanceFieldResolve.comp";
+        resolveProgram = Utils::OpenGL::createComputeProgram(computeShaderSource);
+    }
+
+    // Must be called after the voxel mip maps are generated. Returns false when the
+    // distance field was already built for the current voxels.
+    bool update()
+    {
+        if(built && builtRevision == voxelTexture->revision)
+            return false;
+
+        if(currentGenerationType == JUMP_FLOOD_GPU)
+            generateGPU();
+        else if(currentGenerationType == EXACT_CPU)
+            generateCPU();
+
+        builtRevision = voxelTexture->revision;
+        built = true;
+        return true;
+    }
+
+    void changeGenerationType()
+    {
+        currentGenerationType = (GenerationType)((currentGenerationType + 1) % MAX_GENERATION_TYPES);
+        built = false;
+    }
+
+private:
+
+    void generateGPU()
+    {
+        uint numGroups = (gridLength + VOXEL_GROUP_SIZE - 1) / VOXEL_GROUP_SIZE;
+
+        // Seed with the occupied voxels
+        glBindImageTexture(JUMP_FLOOD_WRITE_IMAGE_BINDING, seedTextures[0], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32UI);
+        Utils::OpenGL::useProgram(seedProgram);
+        glDispatchCompute(numGroups, numGroups, numGroups);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        // Halve the jump every pass, from half the grid down to a single texel
+        uint currentSeeds = 0;
+        Utils::OpenGL::useProgram(jumpProgram);
+        for(uint jumpStep = gridLength/2; jumpStep >= 1; jumpStep /= 2)
+        {
+            PerPassUBO jumpPass;
+            jumpPass.uJumpStep = jumpStep;
+            uniformRing->commitToGL(PER_PASS_UBO_BINDING, &jumpPass, sizeof(PerPassUBO));
+
+            glBindImageTexture(JUMP_FLOOD_READ_IMAGE_BINDING, seedTextures[currentSeeds], 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI);
+            glBindImageTexture(JUMP_FLOOD_WRITE_IMAGE_BINDING, seedTextures[1-currentSeeds], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32UI);
+            glDispatchCompute(numGroups, numGroups, numGroups);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            currentSeeds = 1-currentSeeds;
+        }
+
+        // Turn the nearest seeds into distances
+        glBindImageTexture(JUMP_FLOOD_READ_IMAGE_BINDING, seedTextures[currentSeeds], 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI);
+        glBindImageTexture(DISTANCE_FIELD_IMAGE_BINDING, distanceTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R16F);
+        Utils::OpenGL::useProgram(resolveProgram);
+        glDispatchCompute(numGroups, numGroups, numGroups);
+    }
+
+    // Exact squared distances with Felzenszwalb and Huttenlocher's separable transform.
+    // Every line along an axis is independent, so each pass is split across threads.
+    void generateCPU()
+    {
+        int length = (int)gridLength;
+        int numVoxels = length*length*length;
+        const float infinity = 1e20f;
+
+        // Read back the voxels the field is built from
+        std::vector<uchar> voxels(numVoxels*4);
+        glActiveTexture(GL_TEXTURE0 + COLOR_TEXTURE_POSX_3D_BINDING);
+        glBindTexture(GL_TEXTURE_3D, voxelTexture->colorTextures[VoxelTexture::POSX]);
+        glGetTexImage(GL_TEXTURE_3D, mipLevel, GL_RGBA, GL_UNSIGNED_BYTE, &voxels[0]);
+
+        std::vector<float> distances(numVoxels);
+        for(int i = 0; i < numVoxels; i++)
+            distances[i] = voxels[i*4 + 3] > 0 ? 0.0f : infinity;
+
+        int strides[3] = {1, length, length*length};
+        for(int axis = 0; axis < 3; axis++)
+        {
+            int strideA = strides[(axis+1)%3];
+            int strideB = strides[(axis+2)%3];
+
+            #pragma omp parallel for
+            for(int line = 0; line < length*length; line++)
+            {
+                int base = (line % length)*strideA + (line / length)*strideB;
+                std::vector<float> f(length), d(length), z(length+1);
+                std::vector<int> v(length);
+
+                for(int i = 0; i < length; i++)
+                    f[i] = distances[base + i*strides[axis]];
+                distanceTransform1D(&f[0], &d[0], &v[0], &z[0], length);
+                for(int i = 0; i < length; i++)
+                    distances[base + i*strides[axis]] = d[i];
+            }
+        }
+
+        // Same conservative bound as the GPU resolve pass
+        const float rootThree = 1.73205081f;
+        std::vector<float> field(numVoxels);
+        #pragma omp parallel for
+        for(int i = 0; i < numVoxels; i++)
+        {
+            if(distances[i] >= infinity)
+                field[i] = rootThree;
+            else
+                field[i] = glm::max(glm::sqrt(distances[i]) - rootThree, 0.0f) / length;
+        }
+
+        glActiveTexture(GL_TEXTURE0 + DISTANCE_FIELD_BINDING);
+        glBindTexture(GL_TEXTURE_3D, distanceTexture);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, length, length, length, GL_RED, GL_FLOAT, &field[0]);
+    }
+
+    // Lower envelope of the parabolas rooted at each sample of f
+    static void distanceTransform1D(const float* f, float* d, int* v, float* z, int n)
+    {
+        int k = 0;
+        v[0] = 0;
+        z[0] = -1e20f;
+        z[1] = 1e20f;
+        for(int q = 1; q < n; q++)
+        {
+            float s = ((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2.0f*(q - v[k]));
+            while(s <= z[k])
+            {
+                k--;
+                s = ((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2.0f*(q - v[k]));
+            }
+            k++;
+            v[k] = q;
+            z[k] = s;
+            z[k+1] = 1e20f;
+        }
+
+        k = 0;
+        for(int q = 0; q < n; q++)
+        {
+            while(z[k+1] < q)
+                k++;
+            d[q] = (float)((q - v[k])*(q - v[k])) + f[v[k]];
+        }
+    }
+};
@@ -0,0 +1,272 @@
+#pragma once
+#include "Utils.h"
+
+// How a pass touches a resource. Image stores and storage buffer writes are incoherent,
+// so whatever reads or writes the resource after them needs a barrier for its own access.
+enum FrameGraphAccess
+{
+    ACCESS_TEXTURE,         // sampled with texture()
+    ACCESS_IMAGE,           // imageLoad/imageStore
+    ACCESS_STORAGE_BUFFER,  // shader storage buffer
+    ACCESS_FRAMEBUFFER,     // color or depth attachment, or blits
+    NUM_ACCESS_TYPES
+};
+
+// Runs the frame's passes in the order they were added. Passes declare the resources they
+// read and write, and every frame the graph:
+// 1) culls the passes that don't lead to one of the frame's outputs, walking back from the outputs
+// 2) issues one glMemoryBarrier before a pass, with only the bits its accesses need after
+//    earlier incoherent writes. The writes are tracked across frames.
+// 3) times every pass that ran
+class FrameGraph
+{
+public:
+
+    // Returns whether the pass wrote anything. A pass that had nothing to do
+    // leaves its resources as they were, so readers don't need a barrier.
+    typedef bool (*PassFunction)();
+
+private:
+
+    struct Access
+    {
+        uint resource;
+        FrameGraphAccess type;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        PassFunction function;
+        std::vector<Access> reads;
+        std::vector<Access> writes;
+        bool enabled;
+        bool culled;
+        Utils::OpenGL::AsyncOpenGLTimer timer;
+    };
+
+    struct Resource
+    {
+        std::string name;
+        GLbitfield pendingBarriers; // bits still needed since the last incoherent write
+    };
+
+    std::vector<Pass*> passes;
+    std::vector<Resource> resources;
+    std::vector<bool> neededResources;
+
+    static GLbitfield barrierBit(FrameGraphAccess type)
+    {
+        switch(type)
+        {
+            case ACCESS_TEXTURE:        return GL_TEXTURE_FETCH_BARRIER_BIT;
+            case ACCESS_IMAGE:          return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+            case ACCESS_STORAGE_BUFFER: return GL_SHADER_STORAGE_BARRIER_BIT;
+            case ACCESS_FRAMEBUFFER:    return GL_FRAMEBUFFER_BARRIER_BIT;
+            default:                    return 0;
+        }
+    }
+
+    static bool isIncoherent(FrameGraphAccess type)
+    {
+        return type == ACCESS_IMAGE || type == ACCESS_STORAGE_BUFFER;
+    }
+
+    // Bits needed before the accesses, which are then no longer pending
+    GLbitfield takeBarriers(const std::vector<Access>& accesses)
+    {
+        GLbitfield barriers = 0;
+        for(uint i = 0; i < accesses.size(); i++)
+        {
+            Resource& resource = resources[accesses[i].resource];
+            GLbitfield bit = barrierBit(accesses[i].type);
+            if(resource.pendingBarriers & bit)
+            {
+                barriers |= bit;
+                resource.pendingBarriers &= ~bit;
+            }
+        }
+        return barriers;
+    }
+
+public:
+
+    ~FrameGraph()
+    {
+        for(uint i = 0; i < passes.size(); i++)
+            delete passes[i];
+    }
+
+    uint addResource(const std::string& name)
+    {
+        Resource resource;
+        resource.name = name;
+        resource.pendingBarriers = 0;
+        resources.push_back(resource);
+        neededResources.push_back(false);
+        return resources.size() - 1;
+    }
+
+    uint addPass(const std::string& name, PassFunction function)
+    {
+        Pass* pass = new Pass();
+        pass->name = name;
+        pass->function = function;
+        pass->enabled = true;
+        pass->culled = false;
+        pass->timer.begin();
+        passes.push_back(pass);
+        return passes.size() - 1;
+    }
+
+    void read(uint pass, uint resource, FrameGraphAccess type)
+    {
+        Access access = {resource, type};
+        passes[pass]->reads.push_back(access);
+    }
+
+    void write(uint pass, uint resource, FrameGraphAccess type)
+    {
+        Access access = {resource, type};
+        passes[pass]->writes.push_back(access);
+    }
+
+    // Disabled passes never run and don't count as writers
+    void setEnabled(uint pass, bool enabled)
+    {
+        passes[pass]->enabled = enabled;
+    }
+
+    void execute(uint output)
+    {
+        // Walk back from the output. A pass is needed when it writes a needed resource,
+        // and then everything it reads is needed too.
+        for(uint i = 0; i < neededResources.size(); i++)
+            neededResources[i] = false;
+        neededResources[output] = true;
+
+        for(int i = (int)passes.size() - 1; i >= 0; i--)
+        {
+            Pass* pass = passes[i];
+            pass->culled = true;
+            if(!pass->enabled)
+                continue;
+
+            for(uint j = 0; j < pass->writes.size(); j++)
+                if(neededResources[pass->writes[j].resource])
+                    pass->culled = false;
+
+            if(!pass->culled)
+                for(uint j = 0; j < pass->reads.size(); j++)
+                    neededResources[pass->reads[j].resource] = true;
+        }
+
+        for(uint i = 0; i < passes.size(); i++)
+        {
+            Pass* pass = passes[i];
+            if(pass->culled)
+                continue;
+
+            GLbitfield barriers = takeBarriers(pass->reads) | takeBarriers(pass->writes);
+            if(barriers != 0)
+                glMemoryBarrier(barriers);
+
+            pass->timer.startTimer();
+            bool wrote = pass->function();
+            pass->timer.stopTimer();
+
+            // Incoherent writes have to be made visible to every kind of access that follows
+            if(wrote)
+            {
+                for(uint j = 0; j < pass->writes.size(); j++)
+                {
+                    if(!isIncoherent(pass->writes[j].type))
+                        continue;
+                    for(uint k = 0; k < NUM_ACCESS_TYPES; k++)
+                        resources[pass->writes[j].resource].pendingBarriers |= barrierBit((FrameGraphAccess)k);
+                }
+            }
+        }
+    }
+
+    bool wasCulled(uint pass)
+    {
+        return passes[pass]->culled;
+    }
+
+    // GPU time of the pass's latest finished run
+    float getElapsedMilliseconds(uint pass)
+    {
+        return passes[pass]->timer.getElapsedTime() / 1000000.0f;
+    }
+
+    void printTimings()
+    {
+        for(uint i = 0; i < passes.size(); i++)
+        {
+            Pass* pass = passes[i];
+            if(pass->culled)
+                printf("%-20s culled\n", pass->name.c_str());
+            else
+                printf("%-20s %.3f ms\n", pass->name.c_str(), getElapsedMilliseconds(i));
+        }
+    }
+};
+
+// Render targets for values that only live between a few steps of a frame. Targets are
+// requested in the order of their first step together with their last, and a texture of
+// the same format whose last step is before the first step of a new request is handed
+// out again instead of allocating another one.
+struct TransientTexturePool
+{
+    struct Entry
+    {
+        GLenum internalFormat;
+        GLuint texture;
+        uint lastStep;
+    };
+
+    std::vector<Entry> entries;
+    int width;
+    int height;
+
+    void begin(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+    }
+
+    GLuint acquire(GLenum internalFormat, uint firstStep, uint lastStep)
+    {
+        for(uint i = 0; i < entries.size(); i++)
+        {
+            Entry& entry = entries[i];
+            if(entry.internalFormat == internalFormat && entry.lastStep < firstStep)
+            {
+                entry.lastStep = lastStep;
+                return entry.texture;
+            }
+        }
+
+        Entry entry;
+        entry.internalFormat = internalFormat;
+        entry.lastStep = lastStep;
+        glGenTextures(1, &entry.texture);
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+        entries.push_back(entry);
+        return entry.texture;
+    }
+
+    uint getNumTextures()
+    {
+        return entries.size();
+    }
+
+    void clear()
+    {
+        for(uint i = 0; i < entries.size(); i++)
+            glDeleteTextures(1, &entries[i].texture);
+        entries.clear();
+    }
+};
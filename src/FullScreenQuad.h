@@ -34,7 +34,7 @@ public:
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short)*numElements, elements, GL_STATIC_DRAW);
 
         glGenVertexArrays(1, &fullScreenVertexArray);
-        glBindVertexArray(fullScreenVertexArray);
+        Utils::OpenGL::bindVertexArray(fullScreenVertexArray);
 
         glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
         glEnableVertexAttribArray(POSITION_ATTR);
@@ -43,22 +43,20 @@ public:
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementArrayBuffer);
 
         //Unbind everything
-        glBindVertexArray(0);
+        Utils::OpenGL::bindVertexArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     }
 
     void display()
     {
-        glBindVertexArray(fullScreenVertexArray);
+        Utils::OpenGL::bindVertexArray(fullScreenVertexArray);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-        glBindVertexArray(0);
     }
 
     void displayInstanced(uint numInstances)
     {
-        glBindVertexArray(fullScreenVertexArray);
+        Utils::OpenGL::bindVertexArray(fullScreenVertexArray);
         glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0, numInstances);
-        glBindVertexArray(0);
     }
 };
\ No newline at end of file
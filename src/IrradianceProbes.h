@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Utils.h"
+#include "ShaderConstants.h"
+#include "FullScreenQuad.h"
+#include "engine/CoreEngine.h"
+
+// A sparse grid of irradiance probes over the scene. Each probe cone traces the voxel
+// mips and stores L1 spherical harmonics, one RGBA16F 3D texture per color channel.
+// Only a few z slices are updated each frame.
+class IrradianceProbes
+{
+private:
+
+    GLuint probeUpdateProgram;
+    FullScreenQuad* fullScreenQuad;
+    PerFrameUBO* perFrame;
+    UniformRingBuffer* uniformRing;
+    GLuint probeSampler;
+    uint slicesPerFrame;
+    uint currentSlice;
+
+public:
+
+    static const uint NUM_CHANNELS = 3;
+    GLuint probeTextures[NUM_CHANNELS];
+    glm::ivec3 gridResolution;
+
+    void begin(CoreEngine* coreEngine, FullScreenQuad* fullScreenQuad, uint maxGridLength, uint slicesPerFrame, PerFrameUBO* perFrame, UniformRingBuffer* uniformRing)
+    {
+        this->fullScreenQuad = fullScreenQuad;
+        this->slicesPerFrame = slicesPerFrame;
+        this->perFrame = perFrame;
+        this->uniformRing = uniformRing;
+        this->currentSlice = 0;
+
+        // Fit the grid to the scene, with maxGridLength probes along the longest axis
+        Scene* scene = coreEngine->scene;
+        glm::vec3 sceneSize = scene->maxBounds - scene->minBounds;
+        float spacing = glm::max(sceneSize.x, glm::max(sceneSize.y, sceneSize.z)) / maxGridLength;
+        gridResolution = glm::max(glm::ivec3(glm::ceil(sceneSize/spacing)), glm::ivec3(1));
+        perFrame->uProbeGridWorld = glm::vec4(scene->minBounds, spacing);
+        perFrame->uProbeGridRes = glm::ivec4(gridResolution, 0);
+
+        // Probes start out black until the voxel region reaches them
+        std::vector<glm::vec4> emptyData(gridResolution.x*gridResolution.y*gridResolution.z, glm::vec4(0.0f));
+        glGenTextures(NUM_CHANNELS, probeTextures);
+        for(uint i = 0; i < NUM_CHANNELS; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + PROBE_TEXTURE_RED_BINDING + i);
+            glBindTexture(GL_TEXTURE_3D, probeTextures[i]);
+            glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, gridResolution.x, gridResolution.y, gridResolution.z);
+            glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, gridResolution.x, gridResolution.y, gridResolution.z, GL_RGBA, GL_FLOAT, &emptyData[0]);
+        }
+
+        // Trilinear interpolation between probes
+        glGenSamplers(1, &probeSampler);
+        Utils::OpenGL::bindSampler(NON_USED_TEXTURE, probeSampler);
+        glSamplerParameteri(probeSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(probeSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(probeSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(probeSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(probeSampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        for(uint i = 0; i < NUM_CHANNELS; i++)
+            Utils::OpenGL::bindSampler(PROBE_TEXTURE_RED_BINDING + i, probeSampler);
+
+        // Create shader program
+        std::string vertexShaderSource = SHADER_DIRECTORY + "fullscreenQuadInstanced.vert";
+        std::string fragmentShaderSource = SHADER_DIRECTORY + "irradianceProbeUpdate.frag";
+        probeUpdateProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
+    }
+
+    // Must be called after the voxel mip maps are generated
+    void update()
+    {
+        // Disable culling, depth test, rendering
+        Utils::OpenGL::setRenderState(false, false, false);
+
+        PerPassUBO probePass;
+        probePass.uProbeSlice = currentSlice;
+        uniformRing->commitToGL(PER_PASS_UBO_BINDING, &probePass, sizeof(PerPassUBO));
+
+        for(uint i = 0; i < NUM_CHANNELS; i++)
+            glBindImageTexture(PROBE_IMAGE_RED_BINDING + i, probeTextures[i], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+        // One instance per z slice, the last batch stops at the end of the grid
+        uint numSlices = glm::min(slicesPerFrame, (uint)gridResolution.z - currentSlice);
+        Utils::OpenGL::useProgram(probeUpdateProgram);
+        Utils::OpenGL::setViewport(gridResolution.x, gridResolution.y);
+        fullScreenQuad->displayInstanced(numSlices);
+
+        currentSlice += slicesPerFrame;
+        if(currentSlice >= (uint)gridResolution.z)
+            currentSlice = 0;
+    }
+};
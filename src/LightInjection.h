@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Utils.h"
+#include "ShaderConstants.h"
+#include "VoxelTexture.h"
+
+// Lights the albedo and normal voxels into the directional color volumes with the
+// shadow map or with cone traced shadows. Geometry is only voxelized when it changes, so a moving light costs
+// this pass and a mip map rebuild instead of rasterizing the scene again.
+class LightInjection
+{
+private:
+
+    GLuint injectionProgram;
+    VoxelTexture* voxelTexture;
+    PerFrameUBO* perFrame;
+    bool useBounce;
+    bool useConeShadows;
+
+    // What the color volumes were last lit with
+    bool injected;
+    bool relightPending;
+    uint injectedRevision;
+    glm::mat4 injectedLightView;
+    glm::vec4 injectedShadowCascade;
+    glm::vec3 injectedLightColor;
+
+public:
+
+    void begin(VoxelTexture* voxelTexture, PerFrameUBO* perFrame)
+    {
+        this->voxelTexture = voxelTexture;
+        this->perFrame = perFrame;
+        this->useBounce = false;
+        this->useConeShadows = false;
+
+        // Create shader program
+        createProgram();
+    }
+
+    // Add the light gathered by VoxelBounce. It changes every frame, so the
+    // voxels are relit every frame while this is on.
+    void setBounce(bool useBounce)
+    {
+        this->useBounce = useBounce;
+        createProgram();
+    }
+
+    // Trace shadow cones through the voxel mips instead of reading the shadow map
+    void setConeShadows(bool useConeShadows)
+    {
+        this->useConeShadows = useConeShadows;
+        createProgram();
+    }
+
+    void createProgram()
+    {
+        injected = false;
+        std::string computeShaderSource = SHADER_DIRECTORY + "lightInjection.comp";
+        std::string defines;
+        if (useBounce) defines += "#define VOXEL_BOUNCE\n";
+        if (useConeShadows) defines += "#define CONE_SHADOWS\n";
+        injectionProgram = Utils::OpenGL::createComputeProgram(computeShaderSource, defines);
+    }
+
+    // Must be called after the shadow map is rendered. Returns true when the color
+    // volumes were rewritten and their mip maps need to be generated again.
+    bool update()
+    {
+        bool lightChanged = perFrame->uLightView != injectedLightView ||
+            perFrame->uShadowCascades[NUM_SHADOW_CASCADES-1] != injectedShadowCascade ||
+            perFrame->uLightColor != injectedLightColor;
+        bool voxelsChanged = !injected || injectedRevision != voxelTexture->revision;
+        if(!useBounce && !lightChanged && !voxelsChanged && !relightPending)
+            return false;
+
+        inject();
+
+        // Shadow cones read the mip maps that are only rebuilt from this pass,
+        // so new voxels are lit once more when their mips exist
+        relightPending = useConeShadows && voxelsChanged;
+        injected = true;
+        injectedRevision = voxelTexture->revision;
+        injectedLightView = perFrame->uLightView;
+        injectedShadowCascade = perFrame->uShadowCascades[NUM_SHADOW_CASCADES-1];
+        injectedLightColor = perFrame->uLightColor;
+        return true;
+    }
+
+    void inject()
+    {
+        glBindImageTexture(VOXEL_ALBEDO_IMAGE_BINDING, voxelTexture->albedoTexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
+        glBindImageTexture(VOXEL_NORMAL_IMAGE_BINDING, voxelTexture->normalTexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
+        for(uint i = 0; i < voxelTexture->NUM_DIRECTIONS; i++)
+            glBindImageTexture(COLOR_IMAGE_POSX_3D_BINDING + i, voxelTexture->colorTextures[i], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+        uint numGroups = (voxelTexture->voxelGridLength + VOXEL_GROUP_SIZE - 1) / VOXEL_GROUP_SIZE;
+        Utils::OpenGL::useProgram(injectionProgram);
+        glDispatchCompute(numGroups, numGroups, numGroups);
+    }
+};
@@ -2,6 +2,7 @@
 
 #include "Utils.h"
 #include "ShaderConstants.h"
+#include "engine/Buffer.h"
 #include "VoxelTexture.h"
 #include "FullScreenQuad.h"
 
@@ -12,17 +13,15 @@ private:
     GLuint mipmapProgram;
     VoxelTexture* voxelTexture;
     FullScreenQuad* fullScreenQuad;
-    PerFrameUBO* perFrame;
-    GLuint perFrameUBO;
+    UniformRingBuffer* uniformRing;
 
 public:
 
-    void begin(VoxelTexture* voxelTexture, FullScreenQuad* fullScreenQuad, PerFrameUBO* perFrame, GLuint perFrameUBO)
+    void begin(VoxelTexture* voxelTexture, FullScreenQuad* fullScreenQuad, UniformRingBuffer* uniformRing)
     {
         this->voxelTexture = voxelTexture;
         this->fullScreenQuad = fullScreenQuad;
-        this->perFrame = perFrame;
-        this->perFrameUBO = perFrameUBO;
+        this->uniformRing = uniformRing;
 
         // Create mipmap shader program
         std::string vertexShaderSource = SHADER_DIRECTORY + "fullscreenQuadInstanced.vert";
@@ -36,13 +35,17 @@ public:
         Utils::OpenGL::setRenderState(false, false, false);
 
         // Mip-map
-        glUseProgram(mipmapProgram);
-        glBindBuffer(GL_UNIFORM_BUFFER, perFrameUBO);
+        Utils::OpenGL::useProgram(mipmapProgram);
         int voxelGridLength = voxelTexture->voxelGridLength;
         for(uint i = 1; i < voxelTexture->numMipMapLevels; i++)
         {   
-            perFrame->uCurrentMipLevel = i;
-            glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameUBO), perFrame);
+            // Every level is filtered from the one written before it with texture fetches
+            if(i > 1)
+                glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+            PerPassUBO mipPass;
+            mipPass.uCurrentMipLevel = i;
+            uniformRing->commitToGL(PER_PASS_UBO_BINDING, &mipPass, sizeof(PerPassUBO));
 
             // Bind the six texture directions for writing
             for(uint j = 0; j < voxelTexture->NUM_DIRECTIONS; j++)
@@ -53,6 +56,5 @@ public:
             Utils::OpenGL::setViewport(voxelGridLength, voxelGridLength);
             fullScreenQuad->displayInstanced(voxelGridLength);
         }
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
     }
 };
\ No newline at end of file
@@ -0,0 +1,54 @@
+// Entry points newer than OpenGL 4.2, which the bundled gl3w does not load.
+// loadOpenGLExtensions() must be called after gl3wInit().
+
+#pragma once
+
+#include <GL3/gl3w.h>
+#include <GL/glfw.h>
+
+// Compute shaders (4.3)
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+
+// Shader storage buffers (4.3)
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC) (GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+
+// Immutable buffer storage and persistent mapping (4.4)
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC) (GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// Multi draw indirect (4.3)
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC) (GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+
+PFNGLDISPATCHCOMPUTEPROC glDispatchCompute;
+PFNGLMULTIDRAWELEMENTSINDIRECTPROC glMultiDrawElementsIndirect;
+PFNGLBUFFERSTORAGEPROC glBufferStorage;
+
+// The context is only 4.3, so buffer storage is there when the driver offers 4.4 or ARB_buffer_storage
+bool hasBufferStorage;
+
+void loadOpenGLExtensions()
+{
+    glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC) glfwGetProcAddress("glDispatchCompute");
+    glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC) glfwGetProcAddress("glMultiDrawElementsIndirect");
+    glBufferStorage = (PFNGLBUFFERSTORAGEPROC) glfwGetProcAddress("glBufferStorage");
+
+    GLint majorVersion = 0;
+    GLint minorVersion = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+    bool version44 = majorVersion > 4 || (majorVersion == 4 && minorVersion >= 4);
+    hasBufferStorage = glBufferStorage != 0 && (version44 || glfwExtensionSupported("GL_ARB_buffer_storage") == GL_TRUE);
+}
@@ -19,12 +19,13 @@ public:
         passthroughProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
     }
 
-    void passthrough()
+    // Draws the instances already culled into the slot
+    void passthrough(uint cullSlot)
     {        
         // Do not write to the color buffer
         Utils::OpenGL::setScreenSizedViewport();
         Utils::OpenGL::setRenderState(true, true, false);
-        glUseProgram(passthroughProgram);
-        coreEngine->display();
+        Utils::OpenGL::useProgram(passthroughProgram);
+        coreEngine->display(cullSlot);
     }
 };
\ No newline at end of file
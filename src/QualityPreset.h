@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Utils.h"
+
+// Cone tracing quality settings. Each preset becomes a set of defines that is
+// compiled into its own program permutation, so shaders never branch on quality.
+enum QualityLevel {QUALITY_LOW, QUALITY_MEDIUM, QUALITY_HIGH, QUALITY_ULTRA, MAX_QUALITY_LEVELS};
+
+struct QualityPreset
+{
+    const char* name;
+    int conesPerPixel;          // indirect cones per pixel of an interleaved tile
+    int conesPerPixelTemporal;  // indirect cones per pixel when there is valid history
+    int maxSteps;               // max steps taken along a single cone
+    float stepSizeWrtTexel;     // step size relative to the sampled texel size
+    float probeDistance;        // beyond this fraction of the voxel region size pixels read the irradiance probes
+    bool passDiffuse;
+    bool passIndir;
+    bool passSpec;
+
+    std::string getDefines() const
+    {
+        std::ostringstream defines;
+        defines << std::fixed;
+        defines << "#define QUALITY_PRESET " << name << "\n";
+        defines << "#define CONES_PER_PIXEL " << (float)conesPerPixel << "\n";
+        defines << "#define CONES_PER_PIXEL_TEMPORAL " << (float)conesPerPixelTemporal << "\n";
+        defines << "#define MAX_STEPS " << maxSteps << "\n";
+        defines << "#define STEPSIZE_WRT_TEXEL " << stepSizeWrtTexel << "\n";
+        defines << "#define PROBE_DISTANCE_K " << probeDistance << "\n";
+        if (passDiffuse) defines << "#define PASS_DIFFUSE\n";
+        if (passIndir) defines << "#define PASS_INDIR\n";
+        if (passSpec) defines << "#define PASS_SPEC\n";
+        return defines.str();
+    }
+};
+
+const QualityPreset QUALITY_PRESETS[MAX_QUALITY_LEVELS] =
+{
+    // name      cones  temporal  steps  step size  probes  diffuse  indir  spec
+    {"LOW",      1,     1,        64,    0.5f,      0.15f,  true,    true,  false},
+    {"MEDIUM",   1,     1,        128,   0.4f,      0.25f,  true,    true,  true},
+    {"HIGH",     2,     1,        256,   0.3333f,   0.4f,   true,    true,  true},
+    {"ULTRA",    4,     2,        1000,  0.25f,     1.0f,   true,    true,  true},
+};
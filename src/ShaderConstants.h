@@ -15,8 +15,18 @@ const uint DEBUG_COLOR_ATTR  [6]    = {5,6,7,8,9,10};
 // Uniform buffer objects binding points
 const uint PER_FRAME_UBO_BINDING            = 0;
 const uint LIGHT_UBO_BINDING                = 1;
-const uint MESH_MATERIAL_ARRAY_BINDING      = 2;
-const uint POSITION_ARRAY_BINDING           = 3;
+const uint CULL_UBO_BINDING                 = 4;
+const uint PER_VIEW_UBO_BINDING             = 5;
+const uint PER_PASS_UBO_BINDING             = 6;
+
+// Shader storage buffer binding points
+const uint INSTANCE_BUFFER_BINDING          = 0;
+const uint INSTANCE_COMMAND_BUFFER_BINDING  = 1;
+const uint OBJECT_BOUNDS_BUFFER_BINDING     = 2;
+const uint DRAW_COMMAND_BUFFER_BINDING      = 3;
+const uint POSITION_BUFFER_BINDING          = 4;
+const uint MESH_MATERIAL_BUFFER_BINDING     = 5;
+const uint CLUSTER_BOUNDS_BUFFER_BINDING    = 6;
 
 // Sampler binding points
 const uint NON_USED_TEXTURE                             = 0; // Used for modifying textures that shouldn't be bound to a binding point
@@ -28,6 +38,20 @@ const uint COLOR_TEXTURE_POSZ_3D_BINDING                = 5; // front direction
 const uint COLOR_TEXTURE_NEGZ_3D_BINDING                = 6; // back direction
 const uint SHADOW_MAP_BINDING                           = 7;
 const uint DIFFUSE_TEXTURE_ARRAY_SAMPLER_BINDING[10]    = {8,9,10,11,12,13,14,15,16,17};
+const uint INDIRECT_HISTORY_BINDING                     = 18;
+const uint NORMAL_DEPTH_HISTORY_BINDING                 = 19;
+const uint INDIRECT_BINDING                             = 20;
+const uint NORMAL_DEPTH_BINDING                         = 21;
+const uint DIRECT_LIGHT_BINDING                         = 22;
+const uint INDIRECT_ALBEDO_BINDING                      = 23;
+const uint REPROJECTED_HISTORY_BINDING                  = 24;
+const uint PROBE_TEXTURE_RED_BINDING                    = 25; // L1 SH coefficients, one texture per channel
+const uint PROBE_TEXTURE_GREEN_BINDING                  = 26;
+const uint PROBE_TEXTURE_BLUE_BINDING                   = 27;
+const uint SPECULAR_BINDING                             = 28;
+const uint DEPTH_BINDING                                = 29;
+const uint DISTANCE_FIELD_BINDING                       = 30;
+const uint VOXEL_BOUNCE_BINDING                         = 31;
 
 
 // Image binding points
@@ -37,26 +61,84 @@ const uint COLOR_IMAGE_POSY_3D_BINDING              = 2; // up direction
 const uint COLOR_IMAGE_NEGY_3D_BINDING              = 3; // down direction
 const uint COLOR_IMAGE_POSZ_3D_BINDING              = 4; // front direction
 const uint COLOR_IMAGE_NEGZ_3D_BINDING              = 5; // back direction
+const uint PROBE_IMAGE_RED_BINDING                  = 0; // shares units with the color images, only bound during probe updates
+const uint PROBE_IMAGE_GREEN_BINDING                = 1;
+const uint PROBE_IMAGE_BLUE_BINDING                 = 2;
+const uint CONE_TRACE_INDIRECT_IMAGE_BINDING        = 0; // shares units with the color images, only bound during cone tracing
+const uint CONE_TRACE_SPECULAR_IMAGE_BINDING        = 1;
+const uint DISTANCE_FIELD_IMAGE_BINDING             = 0; // shares units with the color images, only bound while building the distance field
+const uint JUMP_FLOOD_READ_IMAGE_BINDING            = 1;
+const uint JUMP_FLOOD_WRITE_IMAGE_BINDING           = 2;
+const uint VOXEL_ALBEDO_IMAGE_BINDING               = 6; // after the color images, so light injection can bind all of them
+const uint VOXEL_NORMAL_IMAGE_BINDING               = 7;
+const uint VOXEL_BOUNCE_IMAGE_BINDING               = 0; // shares units with the color images, only bound during bounce updates
+const uint SHADOW_MAP_BLUR_IMAGE_BINDING            = 0; // shares units with the color images, only bound while blurring the shadow map
 
 // Shadow Map FBO
 const uint SHADOW_MAP_FBO_BINDING = 0;
 const uint BLURRED_MAP_FBO_BINDING = 1;
 
+// Main renderer G-buffer FBO
+const uint DIRECT_LIGHT_FBO_BINDING = 0;
+const uint INDIRECT_ALBEDO_FBO_BINDING = 1;
+const uint NORMAL_DEPTH_FBO_BINDING = 2;
+const uint REPROJECTED_HISTORY_FBO_BINDING = 3;
+
+// Main renderer composite FBO
+const uint FINAL_COLOR_FBO_BINDING = 0;
+const uint INDIRECT_HISTORY_FBO_BINDING = 1;
+
+// Indirect cones are spread over a tile of this many pixels per side
+const uint INTERLEAVE_SIZE = 2;
+
+// Screen tiles traced together by the cone trace compute shader
+const uint CONE_TRACE_TILE_SIZE = 8;
+
+// Shadow map layers. All but the last are fitted to slices of the view frustum,
+// the last one covers the voxel region.
+const uint NUM_SHADOW_CASCADES = 3;
+
+// Shadow map texels per work group side for the blur, and the blur radius in texels
+const uint SHADOW_BLUR_GROUP_SIZE = 16;
+const uint SHADOW_BLUR_RADIUS = 8;
+
+// Views whose visible instances are culled into their own draw commands
+const uint CULL_SLOT_VIEW = 0;
+const uint CULL_SLOT_VOXEL_REGION = 1;
+const uint CULL_SLOT_SHADOW_CASCADE = 2; // one slot per cascade
+
+// Instances per work group of the culling pass
+const uint CULL_GROUP_SIZE = 64;
+
+// Instances are culled at full detail while their bounding sphere covers at least 1/LOD_VIEW_FRACTION
+// of the view's height, and one level coarser every time that halves. The shadow and voxel
+// slots start LOD_OFFSCREEN_BIAS levels coarser than the camera's view.
+const uint LOD_VIEW_FRACTION = 4;
+const uint LOD_OFFSCREEN_BIAS = 1;
+
+// Voxels per work group side for compute passes over the voxel grid
+const uint VOXEL_GROUP_SIZE = 4;
+
+// Voxels per brick side, bounce light is updated a few bricks per frame
+const uint VOXEL_BRICK_SIZE = 8;
+
 // Object properties
 const int POSITION_INDEX        = 0;
 const int MATERIAL_INDEX        = 1;
 
 // Max values
 const uint MAX_TEXTURE_ARRAYS               = 10;
-const uint NUM_OBJECTS_MAX                  = 500;
-const uint NUM_MESHES_MAX                   = 500;
 const uint MAX_POINT_LIGHTS                 = 8;
+const uint MAX_CULL_SLOTS                   = CULL_SLOT_SHADOW_CASCADE + NUM_SHADOW_CASCADES;
 
+// Uniform blocks are split by how often they change. PerFrameUBO is written at the start
+// of a frame and again once the shadow pass has set the light, PerViewUBO once per
+// rasterized view and PerPassUBO by passes that step through levels, slots or slices.
 struct PerFrameUBO
 {
-    glm::mat4 uViewProjection;
     glm::mat4 uLightView;
-    glm::mat4 uLightProj;
+    glm::mat4 uPrevViewProjection;
+    glm::mat4 uInvViewProjection;
     glm::vec3 uCamLookAt;
     float padding1;
     glm::vec3 uCamPos;
@@ -77,5 +159,38 @@ struct PerFrameUBO
     float uNumMips;
     float uSpecularFOV;
     float uSpecularAmount;
+    int uFrameIndex;
+    int padding6;
+    glm::vec4 uProbeGridWorld; //.xyz is origin and .w is the spacing between probes
+    glm::ivec4 uProbeGridRes; //.xyz is the number of probes
+    glm::vec4 uShadowCascades[NUM_SHADOW_CASCADES]; // maps light view .xy to a cascade's texture coordinates, .xy is scale and .zw is offset
+};
+
+struct PerViewUBO
+{
+    glm::mat4 uViewProjection;
+};
+
+struct PerPassUBO
+{
     int uCurrentMipLevel;
+    int uJumpStep; // texel offset of the current jump flood pass
+    int uBounceSlot; // which of the bounce light brick subsets is updated this frame
+    int uBounceSlotCount;
+    int uProbeSlice; // first probe slice being updated
+    int padding1;
+    int padding2;
+    int padding3;
+
+    PerPassUBO() : uCurrentMipLevel(0), uJumpStep(0), uBounceSlot(0), uBounceSlotCount(0), uProbeSlice(0) {}
+};
+
+struct CullUBO
+{
+    glm::mat4 uCullViewProjection;
+    int uCullSlot;
+    int uCullShadowCasters; // non-zero keeps only the objects that cast shadows
+    int uNumInstances;
+    int uNumDrawCommands;
+    glm::vec4 uCullViewOrigin; // camera position with w = 1, or the direction towards an orthographic camera with w = 0
 };
@@ -11,49 +11,59 @@ struct ShadowMap
     Camera* lightCamera;
     FullScreenQuad* fullScreenQuad;
     PerFrameUBO* perFrame;
-    GLuint perFrameUBO;
+    UniformRingBuffer* uniformRing;
 
     GLuint shadowMapProgram;
-    GLuint gaussianBlurXProgram;
-    GLuint gaussianBlurYProgram;
+    GLuint shadowMapBlurProgram;
 
     GLuint shadowMapGenFBO;
     
-    GLuint shadowMapTextures[2];
-    GLuint shadowMapBlurFBO[2];
-
-    GLuint shadowMapBlurSampler;
+    GLuint shadowMapTextures[2];    // the rendered cascades and their blurred copies, one layer per cascade
     GLuint shadowMapMainSampler;
 
-    int shadowMapResolution;
+    int shadowMapResolution;        // per cascade
+    float sceneRadius;
+
+    // Light space square each cascade covers
+    glm::mat4 cascadeProj[NUM_SHADOW_CASCADES];
+
+    // Cascades left out this frame because cone traced shadows cover their whole slice
+    bool skipped[NUM_SHADOW_CASCADES];
+
+    // What each cached cascade was last rendered from
+    bool rendered[NUM_SHADOW_CASCADES];
+    uint renderedGeometryRevision[NUM_SHADOW_CASCADES];
+    glm::mat4 renderedLightView[NUM_SHADOW_CASCADES];
+    glm::mat4 renderedCascadeProj[NUM_SHADOW_CASCADES];
 
-    void begin(int shadowMapResolution, CoreEngine* coreEngine, FullScreenQuad* fullScreenQuad, Camera* lightCamera, PerFrameUBO* perFrame, GLuint perFrameUBO)
+    void begin(int shadowMapResolution, CoreEngine* coreEngine, FullScreenQuad* fullScreenQuad, Camera* lightCamera, PerFrameUBO* perFrame, UniformRingBuffer* uniformRing)
     {
         this->shadowMapResolution = shadowMapResolution;
         this->coreEngine = coreEngine;
         this->fullScreenQuad = fullScreenQuad;
         this->lightCamera = lightCamera;
         this->perFrame = perFrame;
-        this->perFrameUBO = perFrameUBO;
+        this->uniformRing = uniformRing;
+        for(uint i = 0; i < NUM_SHADOW_CASCADES; i++)
+        {
+            this->rendered[i] = false;
+            this->skipped[i] = false;
+        }
+
+        Scene* scene = coreEngine->scene;
+        this->sceneRadius = glm::length(scene->maxBounds - scene->minBounds)/2.0f;
         
         //--------------------------------
         // Generate shadow map FBO
         //--------------------------------
 
-        // Create gaussian blur FBOs. Two textures needed for ping-ponging during blurring step.
+        // The cascades are rendered into the first texture and blurred into the second
         glActiveTexture(GL_TEXTURE0 + NON_USED_TEXTURE);
-        glGenFramebuffers(2, shadowMapBlurFBO);
         glGenTextures(2, shadowMapTextures);
         for(uint i = 0; i <= 1; i++)
         {
-            // Create texture
-            glBindTexture(GL_TEXTURE_2D, shadowMapTextures[i]);
-            glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, shadowMapResolution, shadowMapResolution);
-
-            // Create FBO
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapBlurFBO[i]);
-            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, shadowMapTextures[i], 0);
-            glDrawBuffer(GL_COLOR_ATTACHMENT0);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapTextures[i]);
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32F, shadowMapResolution, shadowMapResolution, NUM_SHADOW_CASCADES);
         }
 
         // Generate depth renderbuffer (32F depth).
@@ -62,25 +72,17 @@ struct ShadowMap
         glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
         glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, shadowMapResolution, shadowMapResolution);
 
-        // Create shadow map gen framebuffer
+        // Create shadow map gen framebuffer. The cascade layer is attached before each is rendered.
         glGenFramebuffers(1, &shadowMapGenFBO);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapGenFBO);
         glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, shadowMapTextures[0], 0);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadowMapTextures[0], 0, 0);
         glDrawBuffer(GL_COLOR_ATTACHMENT0);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
-        // Gaussian blur sampler
-        glGenSamplers(1, &shadowMapBlurSampler);
-        glBindSampler(NON_USED_TEXTURE, shadowMapBlurSampler);
-        glSamplerParameteri(shadowMapBlurSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	    glSamplerParameteri(shadowMapBlurSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	    glSamplerParameteri(shadowMapBlurSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	    glSamplerParameteri(shadowMapBlurSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
         // Main shadow map sampler
         glGenSamplers(1, &shadowMapMainSampler);
-        glBindSampler(NON_USED_TEXTURE, shadowMapMainSampler);
+        Utils::OpenGL::bindSampler(NON_USED_TEXTURE, shadowMapMainSampler);
         glSamplerParameteri(shadowMapMainSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glSamplerParameteri(shadowMapMainSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glSamplerParameteri(shadowMapMainSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
@@ -93,15 +95,9 @@ struct ShadowMap
         std::string fragmentShaderSource = SHADER_DIRECTORY + "shadowMap.frag";
         shadowMapProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
 
-        // Create gaussian blur X shader
-        vertexShaderSource = SHADER_DIRECTORY + "fullscreenQuad.vert";
-        fragmentShaderSource = SHADER_DIRECTORY + "gaussianBlurX.frag";
-        gaussianBlurXProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
-
-        // Create gaussian blur Y shader
-        vertexShaderSource = SHADER_DIRECTORY + "fullscreenQuad.vert";
-        fragmentShaderSource = SHADER_DIRECTORY + "gaussianBlurY.frag";
-        gaussianBlurYProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
+        // Create gaussian blur shader
+        std::string computeShaderSource = SHADER_DIRECTORY + "shadowMapBlur.comp";
+        shadowMapBlurProgram = Utils::OpenGL::createComputeProgram(computeShaderSource);
     }
 
     ~ShadowMap()
@@ -110,54 +106,183 @@ struct ShadowMap
         //glDeleteTextures(1, &shadowMapTexture);
     }
 
-    void display()
+    // Only sets the light in the UBO, for when nothing reads the shadow map this frame
+    void updateLight()
     {
-        // Get light matrices
-        //glm::mat4 worldToLight = lightCamera->createOrthrographicProjectionMatrix() * lightCamera->createViewMatrix();
-        //glm::mat4 offsetMatrix(0.5f, 0.0f, 0.0f, 0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.0f, 0.0f, 0.5f, 0.0f, 0.5f, 0.5f, 0.5f, 1.0f);
-        //glm::mat4 worldToShadowMap = offsetMatrix * worldToLight;
-       
-        // Set UBO with light matrices
-        glBindBuffer(GL_UNIFORM_BUFFER, perFrameUBO);
-        perFrame->uLightView = lightCamera->createViewMatrix();
-        perFrame->uLightProj = lightCamera->createOrthrographicProjectionMatrix(coreEngine->scene->radius);
-        perFrame->uLightColor = glm::vec3(1.0f,1.0f,1.0f);
-        perFrame->uLightDir = -lightCamera->lookDir;
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameUBO), perFrame);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        setLight();
+        uniformRing->commitToGL(PER_FRAME_UBO_BINDING, perFrame, sizeof(PerFrameUBO));
+    }
+
+    // True when the light, the cascade's fit or a shadow caster changed since the cascade was rendered
+    bool isOutOfDate(uint cascade)
+    {
+        return !rendered[cascade] ||
+            renderedGeometryRevision[cascade] != coreEngine->scene->geometryRevision ||
+            renderedLightView[cascade] != perFrame->uLightView ||
+            renderedCascadeProj[cascade] != cascadeProj[cascade];
+    }
 
-        // Generate shadow map
+    // coneShadows is true when the fragments inside the voxel region are shadowed by cone
+    // tracing, so the frustum cascades whose slice lies inside the region aren't rendered
+    void display(bool coneShadows)
+    {
+        // Set UBO with light matrices and cascades
+        setLight();
+        fitCascades(coneShadows);
+        uniformRing->commitToGL(PER_FRAME_UBO_BINDING, perFrame, sizeof(PerFrameUBO));
+
+        // Render the cascades whose cached copy is out of date
+        bool anyRendered = false;
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapGenFBO);
         Utils::OpenGL::setViewport(shadowMapResolution, shadowMapResolution);
-        Utils::OpenGL::clearColorAndDepth();
         Utils::OpenGL::setRenderState(true, true, true);
-        glUseProgram(shadowMapProgram);
-        coreEngine->display();
-
-        // Do the gaussian blur
-        glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_BINDING);
-        glBindSampler(SHADOW_MAP_BINDING, shadowMapBlurSampler);
-        for(int i = 0; i < 2; i++)
+        for(uint i = 0; i < NUM_SHADOW_CASCADES; i++)
         {
-            // Do a y-direction blur on the 0th texture into the 1st
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapBlurFBO[1]);
-            glBindTexture(GL_TEXTURE_2D, shadowMapTextures[0]);
-            glUseProgram(gaussianBlurYProgram);
-            fullScreenQuad->display();
-
-            // Do an x-direction blur on the 1st texture into the 0th
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapBlurFBO[0]);
-            glBindTexture(GL_TEXTURE_2D, shadowMapTextures[1]);
-            glUseProgram(gaussianBlurXProgram);
-            fullScreenQuad->display();
+            if(skipped[i] || !isOutOfDate(i))
+                continue;
+
+            // Clear to the far end of the scene so that objects which don't cast shadows stay lit
+            float farDepth[] = {2.0f*sceneRadius, 0.0f, 0.0f, 0.0f};
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadowMapTextures[0], 0, i);
+            glClearBufferfv(GL_COLOR, 0, farDepth);
+            Utils::OpenGL::clearDepth();
+
+            PerViewUBO cascadeView;
+            cascadeView.uViewProjection = cascadeProj[i] * perFrame->uLightView;
+            uniformRing->commitToGL(PER_VIEW_UBO_BINDING, &cascadeView, sizeof(PerViewUBO));
+
+            // Only the shadow casters inside the cascade are drawn
+            coreEngine->cull(cascadeView.uViewProjection, CULL_SLOT_SHADOW_CASCADE + i, true);
+            Utils::OpenGL::useProgram(shadowMapProgram);
+            coreEngine->display(CULL_SLOT_SHADOW_CASCADE + i);
+
+            rendered[i] = true;
+            renderedGeometryRevision[i] = coreEngine->scene->geometryRevision;
+            renderedLightView[i] = perFrame->uLightView;
+            renderedCascadeProj[i] = cascadeProj[i];
+            anyRendered = true;
         }
 
-        // Set the shadow map to be the active texture
-        glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_BINDING);
-        glBindTexture(GL_TEXTURE_2D, shadowMapTextures[0]);
-        glBindSampler(SHADOW_MAP_BINDING, shadowMapMainSampler);
-        
         // Unbind FBO
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+        // Do the gaussian blur of every cascade in one dispatch, reading texels directly.
+        // Cascades that weren't rendered blur to the same result as before.
+        glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_BINDING);
+        Utils::OpenGL::bindSampler(SHADOW_MAP_BINDING, shadowMapMainSampler);
+        if(anyRendered)
+        {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapTextures[0]);
+            glBindImageTexture(SHADOW_MAP_BLUR_IMAGE_BINDING, shadowMapTextures[1], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
+            Utils::OpenGL::useProgram(shadowMapBlurProgram);
+            uint numGroups = (shadowMapResolution + SHADOW_BLUR_GROUP_SIZE - 1) / SHADOW_BLUR_GROUP_SIZE;
+            glDispatchCompute(numGroups, numGroups, NUM_SHADOW_CASCADES);
+        }
+
+        // Set the blurred shadow map to be the active texture
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapTextures[1]);
+    }
+
+private:
+
+    // The light looks at the scene center from the edge of the scene's bounding sphere,
+    // so every caster lies between depth 0 and twice the radius in all cascades.
+    void setLight()
+    {
+        Scene* scene = coreEngine->scene;
+        glm::vec3 sceneCenter = (scene->minBounds + scene->maxBounds)/2.0f;
+        glm::vec3 lightDir = -lightCamera->lookDir;
+        glm::vec3 up = glm::abs(lightDir.y) > 0.99f ? glm::vec3(1,0,0) : glm::vec3(0,1,0);
+
+        perFrame->uLightView = glm::lookAt(sceneCenter + lightDir*sceneRadius, sceneCenter, up);
+        perFrame->uLightColor = glm::vec3(1.0f,1.0f,1.0f);
+        perFrame->uLightDir = lightDir;
+    }
+
+    // Splits the view frustum between the near plane and the edge of the voxel region into
+    // cascades with the practical split scheme, and gives the last cascade the voxel region
+    // itself so light injection always has a shadow map.
+    void fitCascades(bool coneShadows)
+    {
+        // Frustum corners on the near and far planes
+        glm::vec3 nearCorners[4];
+        glm::vec3 farCorners[4];
+        glm::vec3 nearCenter(0.0f);
+        glm::vec3 farCenter(0.0f);
+        for(uint i = 0; i < 4; i++)
+        {
+            glm::vec2 ndc((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f);
+            glm::vec4 nearCorner = perFrame->uInvViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+            glm::vec4 farCorner = perFrame->uInvViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+            nearCorners[i] = glm::vec3(nearCorner)/nearCorner.w;
+            farCorners[i] = glm::vec3(farCorner)/farCorner.w;
+            nearCenter += nearCorners[i]/4.0f;
+            farCenter += farCorners[i]/4.0f;
+        }
+
+        glm::vec3 viewDir = glm::normalize(farCenter - nearCenter);
+        float nearDepth = glm::dot(nearCenter - perFrame->uCamPos, viewDir);
+        float farDepth = glm::dot(farCenter - perFrame->uCamPos, viewDir);
+        float shadowDepth = glm::min(perFrame->uVoxelRegionWorld.w/2.0f, farDepth);
+
+        const float splitLambda = 0.75f;
+        const uint numFrustumCascades = NUM_SHADOW_CASCADES - 1;
+        float sliceStart = nearDepth;
+        for(uint i = 0; i < numFrustumCascades; i++)
+        {
+            float k = (float)(i+1)/numFrustumCascades;
+            float logSplit = nearDepth * glm::pow(shadowDepth/nearDepth, k);
+            float uniformSplit = nearDepth + (shadowDepth - nearDepth)*k;
+            float sliceEnd = splitLambda*logSplit + (1.0f - splitLambda)*uniformSplit;
+
+            // Bounding sphere of the slice. Points at the same depth along each corner ray
+            // are the same fraction of the way from the near to the far corner.
+            float startFraction = (sliceStart - nearDepth)/(farDepth - nearDepth);
+            float endFraction = (sliceEnd - nearDepth)/(farDepth - nearDepth);
+            glm::vec3 sliceCorners[8];
+            glm::vec3 center(0.0f);
+            for(uint j = 0; j < 4; j++)
+            {
+                sliceCorners[j] = glm::mix(nearCorners[j], farCorners[j], startFraction);
+                sliceCorners[j+4] = glm::mix(nearCorners[j], farCorners[j], endFraction);
+                center += (sliceCorners[j] + sliceCorners[j+4])/8.0f;
+            }
+            float radius = 0.0f;
+            for(uint j = 0; j < 8; j++)
+                radius = glm::max(radius, glm::distance(center, sliceCorners[j]));
+
+            fitCascade(i, center, radius);
+            sliceStart = sliceEnd;
+
+            // A zero scale puts every fragment outside the cascade, so the shaders pass over it
+            skipped[i] = coneShadows && isInsideVoxelRegion(center, radius);
+            if(skipped[i])
+                perFrame->uShadowCascades[i] = glm::vec4(0.0f);
+        }
+
+        // The voxel region only moves in whole steps, so this cascade is mostly cached
+        float regionSize = perFrame->uVoxelRegionWorld.w;
+        glm::vec3 regionCenter = glm::vec3(perFrame->uVoxelRegionWorld) + regionSize/2.0f;
+        fitCascade(NUM_SHADOW_CASCADES-1, regionCenter, regionSize*0.8660254f);
+    }
+
+    bool isInsideVoxelRegion(glm::vec3 center, float radius)
+    {
+        glm::vec3 regionMin = glm::vec3(perFrame->uVoxelRegionWorld);
+        glm::vec3 regionMax = regionMin + perFrame->uVoxelRegionWorld.w;
+        return glm::all(glm::lessThanEqual(regionMin, center - radius)) && glm::all(glm::greaterThanEqual(regionMax, center + radius));
+    }
+
+    void fitCascade(uint cascade, glm::vec3 center, float radius)
+    {
+        // The slice radius doesn't depend on the camera orientation, so only rounding errors
+        // are removed. Moving the center in whole texels keeps edges from shimmering.
+        radius = glm::ceil(radius*16.0f)/16.0f;
+        float texelSize = 2.0f*radius/shadowMapResolution;
+        glm::vec2 lightCenter = glm::vec2(perFrame->uLightView * glm::vec4(center, 1.0f));
+        lightCenter = glm::floor(lightCenter/texelSize)*texelSize;
+
+        cascadeProj[cascade] = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius, 0.0f, 2.0f*sceneRadius);
+        perFrame->uShadowCascades[cascade] = glm::vec4(glm::vec2(0.5f/radius), glm::vec2(0.5f) - lightCenter*(0.5f/radius));
     }
 };
@@ -3,6 +3,7 @@
 // GLEW and GLFW headers
 #include <GL3/gl3w.h>
 #include <GL/glfw.h>
+#include "OpenGLExtensions.h"
 
 // GLM libraries
 #include <glm/glm.hpp>
@@ -210,16 +211,199 @@ namespace Utils
             }
         };
 
+        struct AsyncOpenGLTimer
+        {
+            // Like OpenGLTimer, but reads results a few frames late instead of stalling.
+            // To use:
+            // 1) timer.begin() to initialize
+            // 2) timer.startTimer() before GL command
+            // 3) timer.stopTimer() after GL command
+            // 4) uint total = timer.getElapsedTime() is the latest finished measurement
+
+            static const uint NUM_QUERIES = 4;
+            GLuint queryObjects[NUM_QUERIES];
+            uint nextQuery;
+            uint pendingQueries;
+            uint totalTime;
+            void begin()
+            {
+                glGenQueries(NUM_QUERIES, queryObjects);
+                nextQuery = 0;
+                pendingQueries = 0;
+                totalTime = 0;
+            }
+            void startTimer()
+            {
+                // Only wait on the oldest query if all of them are in flight
+                collectResults(pendingQueries == NUM_QUERIES);
+                glBeginQuery(GL_TIME_ELAPSED, queryObjects[nextQuery]);
+            }
+            void stopTimer()
+            {
+                glEndQuery(GL_TIME_ELAPSED);
+                nextQuery = (nextQuery + 1) % NUM_QUERIES;
+                pendingQueries++;
+            }
+            void collectResults(bool waitForOldest)
+            {
+                while(pendingQueries > 0)
+                {
+                    GLuint oldestQuery = queryObjects[(nextQuery + NUM_QUERIES - pendingQueries) % NUM_QUERIES];
+                    GLuint available = GL_TRUE;
+                    if(!waitForOldest)
+                        glGetQueryObjectuiv(oldestQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+                    if(!available)
+                        break;
+                    glGetQueryObjectuiv(oldestQuery, GL_QUERY_RESULT, &totalTime);
+                    pendingQueries--;
+                    waitForOldest = false;
+                }
+            }
+            uint getElapsedTime()
+            {
+                collectResults(false);
+                return totalTime;
+            }
+        };
+
+        // Shadow copy of the state that passes keep setting to the same values. A call that
+        // wouldn't change anything is dropped and counted as skipped. Every change to these
+        // states has to go through the functions below or the copy goes stale, including
+        // glBindBufferBase/Range on GL_UNIFORM_BUFFER, which also set the generic binding.
+        // VAOs stay bound after drawing, so GL_ELEMENT_ARRAY_BUFFER may only be bound with
+        // vertex array 0 current or while setting up a VAO.
+        struct StateCache
+        {
+            static const uint MAX_SAMPLER_UNITS = 64;
+            static const int UNKNOWN = -1;
+
+            GLuint program;
+            GLuint vertexArray;
+            GLuint uniformBuffer;
+            GLuint samplers[MAX_SAMPLER_UNITS];
+            int cullFace;
+            int depthTest;
+            int colorMask;
+
+            // This frame's calls and the last finished frame's
+            uint issuedCalls;
+            uint skippedCalls;
+            uint lastIssuedCalls;
+            uint lastSkippedCalls;
+
+            StateCache() : program(0), vertexArray(0), uniformBuffer(0), cullFace(UNKNOWN), depthTest(UNKNOWN), colorMask(UNKNOWN),
+                issuedCalls(0), skippedCalls(0), lastIssuedCalls(0), lastSkippedCalls(0)
+            {
+                for(uint i = 0; i < MAX_SAMPLER_UNITS; i++)
+                    samplers[i] = 0;
+            }
+
+            // True when the call has to be issued
+            bool change(GLuint& current, GLuint value)
+            {
+                if(current == value)
+                {
+                    skippedCalls++;
+                    return false;
+                }
+                current = value;
+                issuedCalls++;
+                return true;
+            }
+            bool change(int& current, bool value)
+            {
+                if(current == (int)value)
+                {
+                    skippedCalls++;
+                    return false;
+                }
+                current = (int)value;
+                issuedCalls++;
+                return true;
+            }
+        };
+
+        StateCache stateCache;
+
+        // Call once at the start of every frame
+        void beginStateCacheFrame()
+        {
+            stateCache.lastIssuedCalls = stateCache.issuedCalls;
+            stateCache.lastSkippedCalls = stateCache.skippedCalls;
+            stateCache.issuedCalls = 0;
+            stateCache.skippedCalls = 0;
+        }
+
+        void useProgram(GLuint program)
+        {
+            if(stateCache.change(stateCache.program, program))
+                glUseProgram(program);
+        }
+
+        void bindVertexArray(GLuint vertexArray)
+        {
+            if(stateCache.change(stateCache.vertexArray, vertexArray))
+                glBindVertexArray(vertexArray);
+        }
+
+        void bindUniformBuffer(GLuint buffer)
+        {
+            if(stateCache.change(stateCache.uniformBuffer, buffer))
+                glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        }
+
+        // Indexed bindings always change, only the generic binding they also set is tracked
+        void bindUniformBufferBase(GLuint index, GLuint buffer)
+        {
+            glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+            stateCache.uniformBuffer = buffer;
+            stateCache.issuedCalls++;
+        }
+
+        void bindUniformBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+        {
+            glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+            stateCache.uniformBuffer = buffer;
+            stateCache.issuedCalls++;
+        }
+
+        // For deleting a buffer, which GL unbinds if it's bound
+        void forgetUniformBuffer(GLuint buffer)
+        {
+            if(stateCache.uniformBuffer == buffer)
+                stateCache.uniformBuffer = 0;
+        }
+
+        void bindSampler(GLuint unit, GLuint sampler)
+        {
+            if(unit >= StateCache::MAX_SAMPLER_UNITS)
+            {
+                glBindSampler(unit, sampler);
+                stateCache.issuedCalls++;
+            }
+            else if(stateCache.change(stateCache.samplers[unit], sampler))
+                glBindSampler(unit, sampler);
+        }
+
         void setRenderState(bool enableCulling, bool enableDepth, bool enableColor)
         {
-            if(enableCulling) glEnable(GL_CULL_FACE);
-            else glDisable(GL_CULL_FACE);
+            if(stateCache.change(stateCache.cullFace, enableCulling))
+            {
+                if(enableCulling) glEnable(GL_CULL_FACE);
+                else glDisable(GL_CULL_FACE);
+            }
 
-            if(enableDepth) glEnable(GL_DEPTH_TEST);
-            else glDisable(GL_DEPTH_TEST);
+            if(stateCache.change(stateCache.depthTest, enableDepth))
+            {
+                if(enableDepth) glEnable(GL_DEPTH_TEST);
+                else glDisable(GL_DEPTH_TEST);
+            }
 
-            if(enableColor) glColorMask(GL_TRUE,GL_TRUE,GL_TRUE,GL_TRUE);
-            else glColorMask(GL_FALSE,GL_FALSE,GL_FALSE,GL_FALSE);
+            if(stateCache.change(stateCache.colorMask, enableColor))
+            {
+                if(enableColor) glColorMask(GL_TRUE,GL_TRUE,GL_TRUE,GL_TRUE);
+                else glColorMask(GL_FALSE,GL_FALSE,GL_FALSE,GL_FALSE);
+            }
         }
 
         int screenWidth;
@@ -301,7 +485,33 @@ namespace Utils
             return Result == GL_TRUE;
         }
 
-        GLuint createShader(GLenum Type, std::string const & Source)
+        // Replaces every #include "name" line with the file of that name in the shader directory
+        std::string expandIncludes(std::string const & Source)
+        {
+            std::string Expanded;
+            size_t LineStart = 0;
+            while(LineStart < Source.size())
+            {
+                size_t LineEnd = Source.find('\n', LineStart);
+                if(LineEnd == std::string::npos)
+                    LineEnd = Source.size();
+                std::string Line = Source.substr(LineStart, LineEnd - LineStart);
+
+                size_t NameStart = Line.find('"');
+                size_t NameEnd = Line.rfind('"');
+                if(Line.compare(0, 8, "#include") == 0 && NameStart != std::string::npos && NameEnd > NameStart)
+                    Expanded += Utils::loadFile(SHADER_DIRECTORY + Line.substr(NameStart + 1, NameEnd - NameStart - 1)) + '\n';
+                else
+                    Expanded += Line + '\n';
+
+                LineStart = LineEnd + 1;
+            }
+            return Expanded;
+        }
+
+        // Defines are inserted after globals so they come after the #version line, and
+        // includes are expanded after them so included files see the defines
+        GLuint createShader(GLenum Type, std::string const & Source, std::string const & Defines = std::string())
         {
             bool Validated = true;
             GLuint Name = 0;
@@ -309,7 +519,7 @@ namespace Utils
             if(!Source.empty())
             {
                 std::string globalsShader = SHADER_DIRECTORY + "globals"; //should probably offload the globals loading to a different place
-                std::string SourceContent = Utils::loadFile(globalsShader) + '\n' + Utils::loadFile(Source);
+                std::string SourceContent = Utils::loadFile(globalsShader) + '\n' + Defines + expandIncludes(Utils::loadFile(Source));
                 char const * SourcePointer = SourceContent.c_str();
                 Name = glCreateShader(Type);
                 glShaderSource(Name, 1, &SourcePointer, NULL);
@@ -351,12 +561,20 @@ namespace Utils
             return Error == GL_NO_ERROR;
         }
 
+        // Programs are cached by their sources and defines, so switching back to a permutation is free
+        std::map<std::string, GLuint> shaderProgramCache;
+
         // Returns the shader program
-        GLuint createShaderProgram(std::string& vertexShader, std::string& fragmentShader)
+        GLuint createShaderProgram(std::string& vertexShader, std::string& fragmentShader, std::string const & defines = std::string())
         {
-            printf("Compiling:\n%s\n%s\n", vertexShader.c_str(), fragmentShader.c_str());
-            GLuint vertexShaderObject = Utils::OpenGL::createShader(GL_VERTEX_SHADER, vertexShader);
-            GLuint fragmentShaderObject = Utils::OpenGL::createShader(GL_FRAGMENT_SHADER, fragmentShader);
+            std::string key = vertexShader + '|' + fragmentShader + '|' + defines;
+            std::map<std::string, GLuint>::iterator cached = shaderProgramCache.find(key);
+            if(cached != shaderProgramCache.end())
+                return cached->second;
+
+            printf("Compiling:\n%s\n%s\n%s", vertexShader.c_str(), fragmentShader.c_str(), defines.c_str());
+            GLuint vertexShaderObject = Utils::OpenGL::createShader(GL_VERTEX_SHADER, vertexShader, defines);
+            GLuint fragmentShaderObject = Utils::OpenGL::createShader(GL_FRAGMENT_SHADER, fragmentShader, defines);
 
             GLuint shaderProgram = glCreateProgram();
             glAttachShader(shaderProgram, vertexShaderObject);
@@ -367,6 +585,29 @@ namespace Utils
             glLinkProgram(shaderProgram);
             Utils::OpenGL::checkProgram(shaderProgram);
 
+            shaderProgramCache[key] = shaderProgram;
+            return shaderProgram;
+        }
+
+        // Returns the compute program, cached the same way as createShaderProgram
+        GLuint createComputeProgram(std::string& computeShader, std::string const & defines = std::string())
+        {
+            std::string key = computeShader + '|' + defines;
+            std::map<std::string, GLuint>::iterator cached = shaderProgramCache.find(key);
+            if(cached != shaderProgramCache.end())
+                return cached->second;
+
+            printf("Compiling:\n%s\n%s", computeShader.c_str(), defines.c_str());
+            GLuint computeShaderObject = Utils::OpenGL::createShader(GL_COMPUTE_SHADER, computeShader, defines);
+
+            GLuint shaderProgram = glCreateProgram();
+            glAttachShader(shaderProgram, computeShaderObject);
+            glDeleteShader(computeShaderObject);
+
+            glLinkProgram(shaderProgram);
+            Utils::OpenGL::checkProgram(shaderProgram);
+
+            shaderProgramCache[key] = shaderProgram;
             return shaderProgram;
         }
 
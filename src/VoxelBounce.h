@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Utils.h"
+#include "ShaderConstants.h"
+#include "engine/Buffer.h"
+#include "VoxelTexture.h"
+
+// Multi-bounce indirect light. Each frame a subset of the voxel bricks cone traces the
+// current color mips and stores the gathered light, which light injection adds back into
+// the color volumes. Every sweep over the grid adds one more bounce, and spreading the
+// sweep over several frames keeps the per frame cost bounded.
+class VoxelBounce
+{
+private:
+
+    GLuint bounceProgram;
+    GLuint clearProgram;
+    VoxelTexture* voxelTexture;
+    UniformRingBuffer* uniformRing;
+    uint bricksPerFrame;
+    uint numSlots;      // frames a full sweep takes
+    uint currentSlot;
+    uint tracedRevision; // voxel revision the stored bounce light belongs to
+
+    void clearBounceLight()
+    {
+        glBindImageTexture(VOXEL_BOUNCE_IMAGE_BINDING, bounceTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R11F_G11F_B10F);
+        Utils::OpenGL::useProgram(clearProgram);
+        uint numGroups = (voxelTexture->voxelGridLength + VOXEL_GROUP_SIZE - 1) / VOXEL_GROUP_SIZE;
+        glDispatchCompute(numGroups, numGroups, numGroups);
+    }
+
+public:
+
+    GLuint bounceTexture;
+
+    void begin(VoxelTexture* voxelTexture, uint bricksPerFrame, UniformRingBuffer* uniformRing)
+    {
+        this->voxelTexture = voxelTexture;
+        this->uniformRing = uniformRing;
+        this->currentSlot = 0;
+        this->tracedRevision = voxelTexture->revision;
+
+        uint voxelGridLength = voxelTexture->voxelGridLength;
+        uint bricksPerSide = voxelGridLength / VOXEL_BRICK_SIZE;
+        uint numBricks = bricksPerSide*bricksPerSide*bricksPerSide;
+        this->bricksPerFrame = glm::min(bricksPerFrame, numBricks);
+        this->numSlots = (numBricks + this->bricksPerFrame - 1) / this->bricksPerFrame;
+
+        glActiveTexture(GL_TEXTURE0 + VOXEL_BOUNCE_BINDING);
+        glGenTextures(1, &bounceTexture);
+        glBindTexture(GL_TEXTURE_3D, bounceTexture);
+        glTexStorage3D(GL_TEXTURE_3D, 1, GL_R11F_G11F_B10F, voxelGridLength, voxelGridLength, voxelGridLength);
+
+        // Create shader programs
+        std::string computeShaderSource = SHADER_DIRECTORY + "voxelBounce.comp";
+        bounceProgram = Utils::OpenGL::createComputeProgram(computeShaderSource);
+        std::string clearShaderSource = SHADER_DIRECTORY + "voxelBounceClear.comp";
+        clearProgram = Utils::OpenGL::createComputeProgram(clearShaderSource);
+
+        // Bounced light starts out black. The frame graph doesn't see this write, so it gets its own barrier.
+        clearBounceLight();
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    // Traces this frame's bricks. Must be called before light injection, while the
+    // mip maps still hold the previous frame's light. When the voxels were rewritten
+    // the stored light belongs to other cells and the mips to the old voxels, so the
+    // light is cleared and the sweep starts over on the next frame.
+    void update()
+    {
+        if(tracedRevision != voxelTexture->revision)
+        {
+            clearBounceLight();
+            currentSlot = 0;
+            tracedRevision = voxelTexture->revision;
+            return;
+        }
+
+        PerPassUBO bouncePass;
+        bouncePass.uBounceSlot = currentSlot;
+        bouncePass.uBounceSlotCount = numSlots;
+        uniformRing->commitToGL(PER_PASS_UBO_BINDING, &bouncePass, sizeof(PerPassUBO));
+
+        glBindImageTexture(VOXEL_ALBEDO_IMAGE_BINDING, voxelTexture->albedoTexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
+        glBindImageTexture(VOXEL_NORMAL_IMAGE_BINDING, voxelTexture->normalTexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
+        glBindImageTexture(VOXEL_BOUNCE_IMAGE_BINDING, bounceTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R11F_G11F_B10F);
+
+        Utils::OpenGL::useProgram(bounceProgram);
+        glDispatchCompute(bricksPerFrame, 1, 1);
+        currentSlot = (currentSlot + 1) % numSlots;
+    }
+};
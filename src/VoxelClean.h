@@ -29,12 +29,13 @@ public:
         Utils::OpenGL::setViewport(voxelGridLength, voxelGridLength);
         Utils::OpenGL::setRenderState(false, false, false);
 
-        // Bind the six texture directions for writing
-        for(uint i = 0; i < voxelTexture->NUM_DIRECTIONS; i++)
-            glBindImageTexture(COLOR_IMAGE_POSX_3D_BINDING + i, voxelTexture->colorTextures[i], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        // Bind the surface property textures for writing. The color textures are
+        // entirely rewritten by light injection, so they don't need cleaning.
+        glBindImageTexture(VOXEL_ALBEDO_IMAGE_BINDING, voxelTexture->albedoTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glBindImageTexture(VOXEL_NORMAL_IMAGE_BINDING, voxelTexture->normalTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
 
         // Clean the base mip map
-        glUseProgram(cleanProgram);
+        Utils::OpenGL::useProgram(cleanProgram);
         fullScreenQuad->displayInstanced(voxelGridLength);
     }
 };
\ No newline at end of file
@@ -14,6 +14,8 @@ class VoxelTexture
 public:
 
     std::vector<GLuint> colorTextures;
+    GLuint albedoTexture;   // surface properties written by the voxelizer, base level only
+    GLuint normalTexture;   // averaged normals, .a is emission in its top 4 bits
     
     // Samplers
     enum VoxelDirections {POSX, NEGX, POSY, NEGY, POSZ, NEGZ, NUM_DIRECTIONS};
@@ -25,11 +27,13 @@ public:
     uint voxelGridLength;
     uint numMipMapLevels;
     uint totalVoxels;
+    uint revision; // bumped every time the voxels are rewritten
     std::vector<MipMapInfo> mipMapInfoArray;
 
     void begin(uint voxelGridLength, uint numMipMapLevels)
     {
         this->voxelGridLength = voxelGridLength;
+        this->revision = 0;
 
         // Set num mipmaps based on the grid length
         if(numMipMapLevels == 0)
@@ -43,7 +47,7 @@ public:
 
         // Nearest
         glGenSamplers(1, &textureNearestSampler);
-        glBindSampler(NON_USED_TEXTURE, textureNearestSampler);
+        Utils::OpenGL::bindSampler(NON_USED_TEXTURE, textureNearestSampler);
         glSamplerParameterfv(textureNearestSampler, GL_TEXTURE_BORDER_COLOR, zeroes);
         glSamplerParameterf(textureNearestSampler, GL_TEXTURE_MIN_LOD, (float)baseLevel);
         glSamplerParameterf(textureNearestSampler, GL_TEXTURE_MAX_LOD, (float)maxLevel);
@@ -55,7 +59,7 @@ public:
 
         // Linear
         glGenSamplers(1, &textureLinearSampler);
-        glBindSampler(NON_USED_TEXTURE, textureLinearSampler);
+        Utils::OpenGL::bindSampler(NON_USED_TEXTURE, textureLinearSampler);
         glSamplerParameterfv(textureLinearSampler, GL_TEXTURE_BORDER_COLOR, zeroes);
         glSamplerParameterf(textureNearestSampler, GL_TEXTURE_MIN_LOD, (float)baseLevel);
         glSamplerParameterf(textureNearestSampler, GL_TEXTURE_MAX_LOD, (float)maxLevel);
@@ -79,6 +83,15 @@ public:
             glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, maxLevel);
         }
         
+        // Create the surface property textures that light is injected from
+        glActiveTexture(GL_TEXTURE0 + NON_USED_TEXTURE);
+        glGenTextures(1, &albedoTexture);
+        glBindTexture(GL_TEXTURE_3D, albedoTexture);
+        glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA8, voxelGridLength, voxelGridLength, voxelGridLength);
+        glGenTextures(1, &normalTexture);
+        glBindTexture(GL_TEXTURE_3D, normalTexture);
+        glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA8, voxelGridLength, voxelGridLength, voxelGridLength);
+
         // Store mipmap data
         int numVoxels = 0;
         int mipMapSideLength = voxelGridLength;
@@ -103,9 +116,9 @@ public:
         for (uint i = 0; i < NUM_DIRECTIONS; i++)
         {
             if (currentSamplerType == LINEAR)
-                glBindSampler(COLOR_TEXTURE_POSX_3D_BINDING + i, textureLinearSampler);
+                Utils::OpenGL::bindSampler(COLOR_TEXTURE_POSX_3D_BINDING + i, textureLinearSampler);
             else if (currentSamplerType == NEAREST)
-                glBindSampler(COLOR_TEXTURE_POSX_3D_BINDING + i, textureNearestSampler);
+                Utils::OpenGL::bindSampler(COLOR_TEXTURE_POSX_3D_BINDING + i, textureNearestSampler);
         }
     }
     void changeSamplerType()
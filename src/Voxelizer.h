@@ -11,17 +11,23 @@ private:
     CoreEngine* coreEngine;
     Camera* viewCamera;
     PerFrameUBO* perFrame;
-    GLuint perFrameUBO;
+    UniformRingBuffer* uniformRing;
     GLuint voxelizerProgram;
+
+    // What the voxels were last built from
+    bool voxelized;
+    uint voxelizedGeometryRevision;
+    glm::vec4 voxelizedRegion;
 public:
 
-    void begin(VoxelTexture* voxelTexture, CoreEngine* coreEngine, Camera* viewCamera, PerFrameUBO* perFrame, GLuint perFrameUBO)
+    void begin(VoxelTexture* voxelTexture, CoreEngine* coreEngine, Camera* viewCamera, PerFrameUBO* perFrame, UniformRingBuffer* uniformRing)
     {
         this->voxelTexture = voxelTexture;
         this->coreEngine = coreEngine;
         this->viewCamera = viewCamera;
         this->perFrame = perFrame;
-        this->perFrameUBO = perFrameUBO;
+        this->uniformRing = uniformRing;
+        this->voxelized = false;
 
         // Create shader program
         std::string vertexShaderSource = SHADER_DIRECTORY + "triangleProcessor.vert";
@@ -29,18 +35,23 @@ public:
         voxelizerProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
     }
 
+    // True when the geometry or the voxel region moved since the last voxelization
+    bool isOutOfDate()
+    {
+        return !voxelized ||
+            voxelizedGeometryRevision != coreEngine->scene->geometryRevision ||
+            voxelizedRegion != perFrame->uVoxelRegionWorld;
+    }
+
     void voxelizeScene()
     {
         uint voxelGridLength = voxelTexture->voxelGridLength;
         Utils::OpenGL::setViewport(voxelGridLength, voxelGridLength);
         Utils::OpenGL::setRenderState(false, false, false);
 
-        // Bind the six texture directions for writing
-        for(uint i = 0; i < voxelTexture->NUM_DIRECTIONS; i++)
-            glBindImageTexture(COLOR_IMAGE_POSX_3D_BINDING + i, voxelTexture->colorTextures[i], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
-        
-        glUseProgram(voxelizerProgram);
-        glBindBuffer(GL_UNIFORM_BUFFER, perFrameUBO);
+        // Bind the surface property textures for writing. They're viewed as single words for the atomics.
+        glBindImageTexture(VOXEL_ALBEDO_IMAGE_BINDING, voxelTexture->albedoTexture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
+        glBindImageTexture(VOXEL_NORMAL_IMAGE_BINDING, voxelTexture->normalTexture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
 
         float worldSize = perFrame->uVoxelRegionWorld.w;
         float halfSize = worldSize/2.0f;
@@ -53,21 +64,30 @@ public:
         
         glm::mat4 orthoProjection = glm::ortho(-halfSize, halfSize, -halfSize, halfSize, 0.0f, worldSize);
 
+        // Every axis sees exactly the voxel region, so the instances are culled once for all three
+        PerViewUBO axisView;
+        axisView.uViewProjection = orthoProjection*glm::lookAt(glm::vec3(bMid.x,bMid.y,bMin.z), glm::vec3(bMid.x,bMid.y,bMax.z), glm::vec3(0,1,0));
+        coreEngine->cull(axisView.uViewProjection, CULL_SLOT_VOXEL_REGION, false);
+
+        Utils::OpenGL::useProgram(voxelizerProgram);
+
         // Render down z-axis
-        perFrame->uViewProjection = orthoProjection*glm::lookAt(glm::vec3(bMid.x,bMid.y,bMin.z), glm::vec3(bMid.x,bMid.y,bMax.z), glm::vec3(0,1,0));
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameUBO), perFrame);
-        coreEngine->display();
+        uniformRing->commitToGL(PER_VIEW_UBO_BINDING, &axisView, sizeof(PerViewUBO));
+        coreEngine->display(CULL_SLOT_VOXEL_REGION);
 
         // Render down y-axis
-        perFrame->uViewProjection = orthoProjection*glm::lookAt(glm::vec3(bMid.x,bMin.y,bMid.z), glm::vec3(bMid.x,bMax.y,bMid.z), glm::vec3(1,0,0));
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameUBO), perFrame);
-        coreEngine->display();
+        axisView.uViewProjection = orthoProjection*glm::lookAt(glm::vec3(bMid.x,bMin.y,bMid.z), glm::vec3(bMid.x,bMax.y,bMid.z), glm::vec3(1,0,0));
+        uniformRing->commitToGL(PER_VIEW_UBO_BINDING, &axisView, sizeof(PerViewUBO));
+        coreEngine->display(CULL_SLOT_VOXEL_REGION);
         
         // Render down x-axis
-        perFrame->uViewProjection = orthoProjection*glm::lookAt(glm::vec3(bMin.x,bMid.y,bMid.z), glm::vec3(bMax.x,bMid.y,bMid.z), glm::vec3(0,0,1));
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameUBO), perFrame);
-        coreEngine->display();
+        axisView.uViewProjection = orthoProjection*glm::lookAt(glm::vec3(bMin.x,bMid.y,bMid.z), glm::vec3(bMax.x,bMid.y,bMid.z), glm::vec3(0,0,1));
+        uniformRing->commitToGL(PER_VIEW_UBO_BINDING, &axisView, sizeof(PerViewUBO));
+        coreEngine->display(CULL_SLOT_VOXEL_REGION);
 
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        voxelized = true;
+        voxelizedGeometryRevision = coreEngine->scene->geometryRevision;
+        voxelizedRegion = perFrame->uVoxelRegionWorld;
+        voxelTexture->revision++;
     }
 };
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include "../Utils.h"
 #include "../ShaderConstants.h"
 #include "../Passthrough.h"
+#include "../FullScreenQuad.h"
+#include "../QualityPreset.h"
+#include "../FrameGraph.h"
 #include "../engine/CoreEngine.h"
 
 class MainRenderer
@@ -10,28 +13,281 @@ class MainRenderer
 private:
 
     GLuint mainRendererProgram;
+    GLuint coneTraceProgram;
+    GLuint interleaveFilterXProgram;
+    GLuint interleaveFilterYProgram;
+    GLuint compositeProgram;
     CoreEngine* coreEngine;
     Passthrough* passthrough;
+    FullScreenQuad* fullScreenQuad;
+    QualityPreset qualityPreset;
+    bool useConeShadows;
+
+    // Steps of a frame, for sharing the targets that only live between a few of them
+    enum Step {GBUFFER_STEP, CONE_TRACE_STEP, FILTER_X_STEP, FILTER_Y_STEP, COMPOSITE_STEP, BLIT_STEP};
+
+    // The normal/depth and indirect history targets are ping-ponged so that last frame's
+    // copies can be read as history while the current frame writes the other pair.
+    // The targets that don't outlive a frame come from the pool.
+    TransientTexturePool transientTextures;
+    GLuint gBufferFBO[2];
+    GLuint filterFBO[2];
+    GLuint compositeFBO[2];
+    GLuint directLightTexture;
+    GLuint indirectAlbedoTexture;
+    GLuint indirectTexture;
+    GLuint specularTexture;
+    GLuint normalDepthTextures[2];
+    GLuint reprojectedHistoryTexture;
+    GLuint filterTextures[2];
+    GLuint indirectHistoryTextures[2];
+    GLuint finalColorTexture;
+    GLuint depthTexture;
+    GLuint linearSampler;
+    GLuint nearestSampler;
+    uint currentTarget;
+    int width;
+    int height;
+
+    GLuint createRenderTexture(GLenum internalFormat)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+        return texture;
+    }
+
+    void bindTexture(uint binding, GLuint texture, GLuint sampler)
+    {
+        glActiveTexture(GL_TEXTURE0 + binding);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        Utils::OpenGL::bindSampler(binding, sampler);
+    }
+
+    void createRenderTargets()
+    {
+        glActiveTexture(GL_TEXTURE0 + NON_USED_TEXTURE);
+
+        // Requested in the order of the step they are first written in. The filter
+        // targets end up sharing the reprojected history's and the cone traced indirect's.
+        transientTextures.begin(width, height);
+        directLightTexture = transientTextures.acquire(GL_RGBA16F, GBUFFER_STEP, COMPOSITE_STEP);
+        reprojectedHistoryTexture = transientTextures.acquire(GL_RGBA16F, GBUFFER_STEP, CONE_TRACE_STEP);
+        indirectAlbedoTexture = transientTextures.acquire(GL_RGBA8, GBUFFER_STEP, COMPOSITE_STEP);
+        indirectTexture = transientTextures.acquire(GL_RGBA16F, CONE_TRACE_STEP, FILTER_X_STEP);
+        specularTexture = transientTextures.acquire(GL_RGBA16F, CONE_TRACE_STEP, COMPOSITE_STEP);
+        filterTextures[0] = transientTextures.acquire(GL_RGBA16F, FILTER_X_STEP, FILTER_Y_STEP);
+        filterTextures[1] = transientTextures.acquire(GL_RGBA16F, FILTER_Y_STEP, COMPOSITE_STEP);
+        finalColorTexture = transientTextures.acquire(GL_RGBA8, COMPOSITE_STEP, BLIT_STEP);
+
+        depthTexture = createRenderTexture(GL_DEPTH_COMPONENT32F);
+        for(uint i = 0; i <= 1; i++)
+        {
+            normalDepthTextures[i] = createRenderTexture(GL_RGBA16F);
+            indirectHistoryTextures[i] = createRenderTexture(GL_RGBA16F);
+        }
+
+        GLenum drawBuffers[4];
+        for(uint i = 0; i < 4; i++)
+            drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+
+        glGenFramebuffers(2, gBufferFBO);
+        glGenFramebuffers(2, filterFBO);
+        glGenFramebuffers(2, compositeFBO);
+        for(uint i = 0; i <= 1; i++)
+        {
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gBufferFBO[i]);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + DIRECT_LIGHT_FBO_BINDING, GL_TEXTURE_2D, directLightTexture, 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + INDIRECT_ALBEDO_FBO_BINDING, GL_TEXTURE_2D, indirectAlbedoTexture, 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + NORMAL_DEPTH_FBO_BINDING, GL_TEXTURE_2D, normalDepthTextures[i], 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + REPROJECTED_HISTORY_FBO_BINDING, GL_TEXTURE_2D, reprojectedHistoryTexture, 0);
+            glDrawBuffers(4, drawBuffers);
+            Utils::OpenGL::checkFramebuffer(gBufferFBO[i]);
+
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, filterFBO[i]);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, filterTextures[i], 0);
+            glDrawBuffers(1, drawBuffers);
+            Utils::OpenGL::checkFramebuffer(filterFBO[i]);
+
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, compositeFBO[i]);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + FINAL_COLOR_FBO_BINDING, GL_TEXTURE_2D, finalColorTexture, 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + INDIRECT_HISTORY_FBO_BINDING, GL_TEXTURE_2D, indirectHistoryTextures[i], 0);
+            glDrawBuffers(2, drawBuffers);
+            Utils::OpenGL::checkFramebuffer(compositeFBO[i]);
+        }
+
+        // Start with empty history. A depth of 0 marks a pixel as having no history.
+        float zeroes[] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for(uint i = 0; i <= 1; i++)
+        {
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gBufferFBO[i]);
+            glClearBufferfv(GL_COLOR, NORMAL_DEPTH_FBO_BINDING, zeroes);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, compositeFBO[i]);
+            glClearBufferfv(GL_COLOR, INDIRECT_HISTORY_FBO_BINDING, zeroes);
+        }
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    }
+
+    void deleteRenderTargets()
+    {
+        glDeleteFramebuffers(2, gBufferFBO);
+        glDeleteFramebuffers(2, filterFBO);
+        glDeleteFramebuffers(2, compositeFBO);
+        transientTextures.clear();
+        glDeleteTextures(1, &depthTexture);
+        glDeleteTextures(2, normalDepthTextures);
+        glDeleteTextures(2, indirectHistoryTextures);
+    }
 
 public:
-    void begin(CoreEngine* coreEngine, Passthrough* passthrough)
+    void begin(CoreEngine* coreEngine, Passthrough* passthrough, FullScreenQuad* fullScreenQuad, const QualityPreset& qualityPreset, bool useConeShadows, int width, int height)
     {
         this->coreEngine = coreEngine;
         this->passthrough = passthrough;
+        this->fullScreenQuad = fullScreenQuad;
+        this->qualityPreset = qualityPreset;
+        this->useConeShadows = useConeShadows;
+        this->width = width;
+        this->height = height;
+        this->currentTarget = 0;
+
+        createRenderTargets();
+
+        // Only the reprojected indirect history is filtered. Normal/depth is not,
+        // so that surfaces are not blended together at edges.
+        glGenSamplers(1, &linearSampler);
+        Utils::OpenGL::bindSampler(NON_USED_TEXTURE, linearSampler);
+        glSamplerParameteri(linearSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(linearSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(linearSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(linearSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+        glGenSamplers(1, &nearestSampler);
+        Utils::OpenGL::bindSampler(NON_USED_TEXTURE, nearestSampler);
+        glSamplerParameteri(nearestSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(nearestSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(nearestSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glSamplerParameteri(nearestSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+        // Create shader programs
+        createPrograms();
+
+        // Create interleave filter X shader
+        std::string vertexShaderSource = SHADER_DIRECTORY + "fullscreenQuad.vert";
+        std::string fragmentShaderSource = SHADER_DIRECTORY + "interleaveFilterX.frag";
+        interleaveFilterXProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
+
+        // Create interleave filter Y shader
+        fragmentShaderSource = SHADER_DIRECTORY + "interleaveFilterY.frag";
+        interleaveFilterYProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
 
-        // Create shader program
+        // Create composite shader
+        fragmentShaderSource = SHADER_DIRECTORY + "mainRendererComposite.frag";
+        compositeProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
+    }
+
+    void setQualityPreset(const QualityPreset& qualityPreset)
+    {
+        this->qualityPreset = qualityPreset;
+        createPrograms();
+    }
+
+    // Trace shadow cones through the voxel mips instead of reading the shadow map
+    void setConeShadows(bool useConeShadows)
+    {
+        this->useConeShadows = useConeShadows;
+        createPrograms();
+    }
+
+    void createPrograms()
+    {
         std::string vertexShaderSource = SHADER_DIRECTORY + "triangleProcessor.vert";
         std::string fragmentShaderSource = SHADER_DIRECTORY + "mainRendererDemo.frag";
-        mainRendererProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
+        std::string defines = qualityPreset.getDefines();
+        if (useConeShadows) defines += "#define CONE_SHADOWS\n";
+        mainRendererProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource, defines);
+
+        std::string computeShaderSource = SHADER_DIRECTORY + "coneTrace.comp";
+        coneTraceProgram = Utils::OpenGL::createComputeProgram(computeShaderSource, qualityPreset.getDefines());
+    }
+
+    void resize(int width, int height)
+    {
+        if(this->width == width && this->height == height)
+            return;
+
+        this->width = width;
+        this->height = height;
+        deleteRenderTargets();
+        createRenderTargets();
     }
 
-    void display()
-    { 
+    void display(const glm::mat4& viewProjection)
+    {
+        uint previousTarget = 1 - currentTarget;
+
+        // The pre-pass and the G-buffer pass draw the same visible instances
+        coreEngine->cull(viewProjection, CULL_SLOT_VIEW, false);
+
+        // Bind last frame's indirect light and normal/depth as history
+        bindTexture(INDIRECT_HISTORY_BINDING, indirectHistoryTextures[previousTarget], linearSampler);
+        bindTexture(NORMAL_DEPTH_HISTORY_BINDING, normalDepthTextures[previousTarget], nearestSampler);
+
+        // Clear the G-buffer. Zero depth in the normal/depth target marks empty pixels.
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gBufferFBO[currentTarget]);
+        float zeroes[] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for(uint i = 0; i < 4; i++)
+            glClearBufferfv(GL_COLOR, i, zeroes);
+        Utils::OpenGL::clearDepth();
+
         // Depth pre-pass
-        passthrough->passthrough();
+        passthrough->passthrough(CULL_SLOT_VIEW);
         Utils::OpenGL::setScreenSizedViewport();
         Utils::OpenGL::setRenderState(true, true, true);
-        glUseProgram(mainRendererProgram);
-        coreEngine->display();
+        Utils::OpenGL::useProgram(mainRendererProgram);
+        coreEngine->display(CULL_SLOT_VIEW);
+
+        // Trace the indirect and specular cones in screen tiles
+        bindTexture(DEPTH_BINDING, depthTexture, nearestSampler);
+        bindTexture(NORMAL_DEPTH_BINDING, normalDepthTextures[currentTarget], nearestSampler);
+        bindTexture(REPROJECTED_HISTORY_BINDING, reprojectedHistoryTexture, nearestSampler);
+        glBindImageTexture(CONE_TRACE_INDIRECT_IMAGE_BINDING, indirectTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        glBindImageTexture(CONE_TRACE_SPECULAR_IMAGE_BINDING, specularTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        Utils::OpenGL::useProgram(coneTraceProgram);
+        glDispatchCompute((width + CONE_TRACE_TILE_SIZE - 1) / CONE_TRACE_TILE_SIZE, (height + CONE_TRACE_TILE_SIZE - 1) / CONE_TRACE_TILE_SIZE, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        // Gather the interleaved indirect cones of neighbouring pixels
+        Utils::OpenGL::setRenderState(false, false, true);
+
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, filterFBO[0]);
+        bindTexture(INDIRECT_BINDING, indirectTexture, nearestSampler);
+        Utils::OpenGL::useProgram(interleaveFilterXProgram);
+        fullScreenQuad->display();
+
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, filterFBO[1]);
+        bindTexture(INDIRECT_BINDING, filterTextures[0], nearestSampler);
+        Utils::OpenGL::useProgram(interleaveFilterYProgram);
+        fullScreenQuad->display();
+
+        // Add the filtered indirect light to the direct light and update the history
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, compositeFBO[currentTarget]);
+        bindTexture(INDIRECT_BINDING, filterTextures[1], nearestSampler);
+        bindTexture(DIRECT_LIGHT_BINDING, directLightTexture, nearestSampler);
+        bindTexture(INDIRECT_ALBEDO_BINDING, indirectAlbedoTexture, nearestSampler);
+        bindTexture(SPECULAR_BINDING, specularTexture, nearestSampler);
+        Utils::OpenGL::useProgram(compositeProgram);
+        fullScreenQuad->display();
+
+        // Copy the final color to the screen
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, compositeFBO[currentTarget]);
+        glReadBuffer(GL_COLOR_ATTACHMENT0 + FINAL_COLOR_FBO_BINDING);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+        currentTarget = previousTarget;
     }
 };
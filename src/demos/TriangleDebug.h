@@ -25,7 +25,7 @@ public:
     {
         Utils::OpenGL::setScreenSizedViewport();
         Utils::OpenGL::setRenderState(true, true, true);
-        glUseProgram(triangleDebugProgram);
+        Utils::OpenGL::useProgram(triangleDebugProgram);
         coreEngine->display();
     }
 };
\ No newline at end of file
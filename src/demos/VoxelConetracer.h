@@ -4,6 +4,7 @@
 #include "../ShaderConstants.h"
 #include "../FullScreenQuad.h"
 #include "../VoxelTexture.h"
+#include "../QualityPreset.h"
 
 class VoxelConetracer
 {
@@ -12,27 +13,51 @@ private:
     GLuint fullScreenProgram;
     VoxelTexture* voxelTexture;
     FullScreenQuad* fullScreenQuad;
+    QualityPreset qualityPreset;
+    bool useDistanceField;
 
 public:
     VoxelConetracer(){}
     virtual ~VoxelConetracer(){}
 
-    void begin(VoxelTexture* voxelTexture, FullScreenQuad* fullScreenQuad)
+    void begin(VoxelTexture* voxelTexture, FullScreenQuad* fullScreenQuad, const QualityPreset& qualityPreset, bool useDistanceField)
     {
         this->voxelTexture = voxelTexture;
         this->fullScreenQuad = fullScreenQuad;
+        this->qualityPreset = qualityPreset;
+        this->useDistanceField = useDistanceField;
 
         // Create shader program
+        createProgram();
+    }
+
+    void setQualityPreset(const QualityPreset& qualityPreset)
+    {
+        this->qualityPreset = qualityPreset;
+        createProgram();
+    }
+
+    // Skip the empty space the cones can't reach using the voxel distance field
+    void setDistanceField(bool useDistanceField)
+    {
+        this->useDistanceField = useDistanceField;
+        createProgram();
+    }
+
+    void createProgram()
+    {
         std::string vertexShaderSource = SHADER_DIRECTORY + "fullscreenQuad.vert";
         std::string fragmentShaderSource = SHADER_DIRECTORY + "conetracerDemo.frag";
-        fullScreenProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
+        std::string defines = qualityPreset.getDefines();
+        if (useDistanceField) defines += "#define DISTANCE_FIELD\n";
+        fullScreenProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource, defines);
     }
 
     void display()
     {
         Utils::OpenGL::setScreenSizedViewport();
         Utils::OpenGL::setRenderState(true, true, true);
-        glUseProgram(fullScreenProgram);
+        Utils::OpenGL::useProgram(fullScreenProgram);
         fullScreenQuad->display();
     }
 };
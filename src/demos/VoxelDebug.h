@@ -85,7 +85,7 @@ public:
         // Don't fill this buffer yet
         
         glGenVertexArrays(1, &vertexArray);
-        glBindVertexArray(vertexArray);
+        Utils::OpenGL::bindVertexArray(vertexArray);
 
         glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
         glEnableVertexAttribArray(POSITION_ATTR);
@@ -109,7 +109,7 @@ public:
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementArrayBuffer);
         
         //Unbind everything
-        glBindVertexArray(0);
+        Utils::OpenGL::bindVertexArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
@@ -209,8 +209,8 @@ public:
         Utils::OpenGL::setScreenSizedViewport();
         Utils::OpenGL::setRenderState(true, true, true);
 
-        glUseProgram(voxelDebugProgram);
-        glBindVertexArray(vertexArray);
+        Utils::OpenGL::useProgram(voxelDebugProgram);
+        Utils::OpenGL::bindVertexArray(vertexArray);
         glDrawElementsInstancedBaseInstance(GL_TRIANGLES, numElementsCube, GL_UNSIGNED_SHORT, 0, primCount, baseInstance);
     }
 
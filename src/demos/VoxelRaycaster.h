@@ -11,20 +11,29 @@ private:
     GLuint fullScreenProgram;
     VoxelTexture* voxelTexture;
     FullScreenQuad* fullScreenQuad;
+    bool useDistanceField;
 
 public:
     VoxelRaycaster(){}
     virtual ~VoxelRaycaster(){}
 
-    void begin(VoxelTexture* voxelTexture, FullScreenQuad* fullScreenQuad)
+    void begin(VoxelTexture* voxelTexture, FullScreenQuad* fullScreenQuad, bool useDistanceField)
     {
         this->voxelTexture = voxelTexture;
         this->fullScreenQuad = fullScreenQuad;
 
         // Create shader program
+        setDistanceField(useDistanceField);
+    }
+
+    // Sphere trace the rays through the voxel distance field
+    void setDistanceField(bool useDistanceField)
+    {
+        this->useDistanceField = useDistanceField;
         std::string vertexShaderSource = SHADER_DIRECTORY + "fullscreenQuad.vert";
         std::string fragmentShaderSource = SHADER_DIRECTORY + "raycasterDemo.frag";
-        fullScreenProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource);
+        std::string defines = useDistanceField ? "#define DISTANCE_FIELD\n" : "";
+        fullScreenProgram = Utils::OpenGL::createShaderProgram(vertexShaderSource, fragmentShaderSource, defines);
     }
 
     void display()
@@ -32,7 +41,7 @@ public:
         Utils::OpenGL::setScreenSizedViewport();
         Utils::OpenGL::setRenderState(true, true, true);
        
-        glUseProgram(fullScreenProgram);
+        Utils::OpenGL::useProgram(fullScreenProgram);
         fullScreenQuad->display();
     }
 };
@@ -19,6 +19,13 @@ struct PerObjectBufferDynamic
     {
         glDeleteBuffers(1, &bufferObject);
     }
+
+    void commitToGL(void* data, int size, int offset)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, bufferObject);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
 };
 
 
@@ -30,22 +37,256 @@ struct UniformBuffer
     UniformBuffer(GLuint bindingIndex, void* data, int bufferSize, GLenum usageType)
     {
         glGenBuffers(1, &bufferObject);
-        glBindBuffer(GL_UNIFORM_BUFFER, bufferObject);
+        Utils::OpenGL::bindUniformBuffer(bufferObject);
         glBufferData(GL_UNIFORM_BUFFER, bufferSize, data, usageType);
-        glBindBufferBase(GL_UNIFORM_BUFFER, bindingIndex, bufferObject);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        Utils::OpenGL::bindUniformBufferBase(bindingIndex, bufferObject);
+        Utils::OpenGL::bindUniformBuffer(0);
     }
 
     ~UniformBuffer()
     {
+        Utils::OpenGL::forgetUniformBuffer(bufferObject);
         glDeleteBuffers(1, &bufferObject);
     }
 
     void commitToGL(void* data, int size, int offset)
     {
-        glBindBuffer(GL_UNIFORM_BUFFER, bufferObject);
+        Utils::OpenGL::bindUniformBuffer(bufferObject);
         glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+};
+
+// Uniform buffer for blocks that are rewritten several times a frame. The storage is
+// persistently mapped and split into NUM_FRAMES regions, one per frame in flight.
+// Every upload copies a block into the next aligned slice of the current region and
+// binds that range to the block's binding point, so a pass never overwrites data an
+// earlier draw still has to read. Any number of blocks can share the ring.
+// A fence per region keeps the CPU from reusing it before the GPU is done with it.
+// A frame that uploads more than a region holds moves the ring to a larger buffer.
+struct UniformRingBuffer
+{
+    static const uint NUM_FRAMES = 3;
+
+    // A buffer the ring grew out of. Ranges of it may still be bound and read by the
+    // GPU, so it's deleted once the frame it was last written in has finished.
+    struct RetiredBuffer
+    {
+        GLuint bufferObject;
+        bool mapped;
+        uint framesLeft;
+    };
+
+    GLuint bufferObject;
+    char* mappedData; // 0 without buffer storage, uploads then map their own range
+    GLsync fences[NUM_FRAMES];
+    uint currentFrame;
+    uint regionSize;
+    uint currentOffset;
+    uint sliceAlignment;
+    std::vector<RetiredBuffer> retiredBuffers;
+
+    // bytesPerFrame is how much, slice alignment included, may be uploaded between two calls to beginFrame()
+    UniformRingBuffer(uint bytesPerFrame)
+    {
+        GLint offsetAlignment;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+        sliceAlignment = (uint)offsetAlignment;
+        regionSize = alignSize(bytesPerFrame);
+        currentFrame = 0;
+        currentOffset = 0;
+        for(uint i = 0; i < NUM_FRAMES; i++)
+            fences[i] = 0;
+        createBuffer();
+    }
+
+    ~UniformRingBuffer()
+    {
+        for(uint i = 0; i < NUM_FRAMES; i++)
+            if(fences[i]) glDeleteSync(fences[i]);
+        deleteBuffer(bufferObject, mappedData != 0);
+        for(uint i = 0; i < retiredBuffers.size(); i++)
+            deleteBuffer(retiredBuffers[i].bufferObject, retiredBuffers[i].mapped);
+    }
+
+    void createBuffer()
+    {
+        glGenBuffers(1, &bufferObject);
+        Utils::OpenGL::bindUniformBuffer(bufferObject);
+        if(hasBufferStorage)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_UNIFORM_BUFFER, regionSize*NUM_FRAMES, NULL, flags);
+            mappedData = (char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, regionSize*NUM_FRAMES, flags);
+        }
+        else
+        {
+            glBufferData(GL_UNIFORM_BUFFER, regionSize*NUM_FRAMES, NULL, GL_STREAM_DRAW);
+            mappedData = 0;
+        }
+        Utils::OpenGL::bindUniformBuffer(0);
+    }
+
+    void deleteBuffer(GLuint buffer, bool mapped)
+    {
+        if(mapped)
+        {
+            Utils::OpenGL::bindUniformBuffer(buffer);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+        Utils::OpenGL::forgetUniformBuffer(buffer);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    // Moves the ring to a new buffer with at least twice the room per frame. The uploads
+    // already made this frame stay where they are bound, in the retired buffer.
+    void grow(uint size)
+    {
+        RetiredBuffer retired = {bufferObject, mappedData != 0, NUM_FRAMES};
+        retiredBuffers.push_back(retired);
+
+        regionSize = alignSize(glm::max(2*regionSize, currentOffset + size));
+        currentOffset = 0;
+        createBuffer();
+        printf("uniform ring buffer grown to %u bytes per frame\n", regionSize);
+    }
+
+    uint alignSize(uint size)
+    {
+        return (size + sliceAlignment - 1) / sliceAlignment * sliceAlignment;
+    }
+
+    // Fences the region written since the last call, which also covers uploads made
+    // during startup, then moves on to the next region. Only waits if the GPU is still
+    // reading the uploads made NUM_FRAMES frames ago.
+    void beginFrame()
+    {
+        if(fences[currentFrame]) glDeleteSync(fences[currentFrame]);
+        fences[currentFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        currentFrame = (currentFrame + 1) % NUM_FRAMES;
+        currentOffset = 0;
+        waitForFence(currentFrame);
+
+        // After NUM_FRAMES calls the wait above covered the frame a buffer was retired in
+        for(uint i = 0; i < retiredBuffers.size();)
+        {
+            if(--retiredBuffers[i].framesLeft > 0)
+            {
+                i++;
+                continue;
+            }
+            deleteBuffer(retiredBuffers[i].bufferObject, retiredBuffers[i].mapped);
+            retiredBuffers.erase(retiredBuffers.begin() + i);
+        }
+    }
+
+    void commitToGL(GLuint bindingIndex, void* data, int size)
+    {
+        // More uploads than the region was sized for, only happens if bytesPerFrame is too small
+        if(currentOffset + size > regionSize)
+            grow(size);
+
+        uint offset = currentFrame*regionSize + currentOffset;
+        if(mappedData)
+        {
+            memcpy(mappedData + offset, data, size);
+        }
+        else
+        {
+            // The fences already keep the GPU out of this region, so the map doesn't need to sync
+            Utils::OpenGL::bindUniformBuffer(bufferObject);
+            void* range = glMapBufferRange(GL_UNIFORM_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+            memcpy(range, data, size);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+        Utils::OpenGL::bindUniformBufferRange(bindingIndex, bufferObject, offset, size);
+        currentOffset += alignSize(size);
+    }
+
+    void waitForFence(uint frame)
+    {
+        if(!fences[frame])
+            return;
+        while(glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fences[frame]);
+        fences[frame] = 0;
+    }
+};
+
+// Wrapper for OpenGL shader storage buffer objects
+struct ShaderStorageBuffer
+{
+    GLuint bufferObject;
+
+    ShaderStorageBuffer(GLuint bindingIndex, void* data, int bufferSize, GLenum usageType)
+    {
+        glGenBuffers(1, &bufferObject);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, bufferSize, data, usageType);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindingIndex, bufferObject);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    ~ShaderStorageBuffer()
+    {
+        glDeleteBuffers(1, &bufferObject);
+    }
+};
+
+// Shader storage buffer for arrays whose length is only known at runtime. Writing past the
+// end grows the buffer to at least twice its size, copying the old contents on the GPU and
+// binding the new buffer in place of the old one, so shaders only declare unsized arrays.
+struct GrowableShaderStorageBuffer
+{
+    GLuint bufferObject;
+    GLuint bindingIndex;
+    GLenum usageType;
+    uint capacity;
+
+    GrowableShaderStorageBuffer(GLuint bindingIndex, uint initialCapacity, GLenum usageType)
+    {
+        this->bindingIndex = bindingIndex;
+        this->usageType = usageType;
+        capacity = std::max(initialCapacity, 16u);
+        glGenBuffers(1, &bufferObject);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, NULL, usageType);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindingIndex, bufferObject);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    ~GrowableShaderStorageBuffer()
+    {
+        glDeleteBuffers(1, &bufferObject);
+    }
+
+    void reserve(uint size)
+    {
+        if(size <= capacity)
+            return;
+
+        uint newCapacity = std::max(size, capacity*2);
+        GLuint newBufferObject;
+        glGenBuffers(1, &newBufferObject);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newBufferObject);
+        glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, NULL, usageType);
+        glBindBuffer(GL_COPY_READ_BUFFER, bufferObject);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, capacity);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        glDeleteBuffers(1, &bufferObject);
+        bufferObject = newBufferObject;
+        capacity = newCapacity;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindingIndex, bufferObject);
+    }
+
+    void commitToGL(void* data, int size, int offset)
+    {
+        reserve(offset + size);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, data);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
     }
 };
 
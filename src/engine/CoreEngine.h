@@ -41,9 +41,26 @@ public:
     {
         scene->display(renderData);
     }
+    // Object transform transfers made by the last updateScene()
+    uint getPositionUploads()
+    {
+        return renderData.positionUploads;
+    }
+    uint getPositionUploadBytes()
+    {
+        return renderData.positionUploadBytes;
+    }
     void display()
     {
         renderData.display();
     }
+    void display(uint cullSlot)
+    {
+        renderData.display(cullSlot);
+    }
+    void cull(const glm::mat4& viewProjection, uint cullSlot, bool shadowCastersOnly)
+    {
+        renderData.cull(viewProjection, cullSlot, shadowCastersOnly);
+    }
 };
     
@@ -185,13 +185,7 @@ struct MaterialLibrary
 
     void commitToGL(RenderData& renderData)
     {
-        if(materials.size() > NUM_MESHES_MAX)
-        {
-            printf("too many materials! Change the NUM_MESHES_MAX constant");
-            return;
-        }
-
-        renderData.commitMaterials(&materials[0], sizeof(MeshMaterial)*materials.size(), sizeof(MeshMaterial)*NUM_MESHES_MAX);
+        renderData.commitMaterials(&materials[0], sizeof(MeshMaterial)*materials.size());
 
         textureLibrary.commitToGL();
     }
@@ -10,6 +10,28 @@ struct Vertex
     glm::vec2 UV;
 };
 
+// 16 bytes. Positions are normalized to the mesh's positionScale, normals are
+// octahedral encoded and UVs are half floats.
+struct CompactVertex
+{
+    glm::i16vec4 position; // .w is padding
+    glm::i16vec2 normal;
+    glm::hvec2 UV;
+};
+
+enum VertexFormat
+{
+    FULL_VERTEX_FORMAT,
+    COMPACT_VERTEX_FORMAT
+};
+
+// Culling bounds of a mesh group in mesh space, see MeshClusterBuilder
+struct ClusterBounds
+{
+    glm::vec4 sphere; // center, radius
+    glm::vec4 cone;   // axis of the triangle normals, sine of its half angle (above 1 when it can't cull)
+};
+
 /*
 // 32 bytes total, because it's a union
 union Vertex
@@ -62,6 +84,9 @@ struct Mesh
     uint elementSize;
     GLenum elementType;
     GLenum drawPrimitive;
+    VertexFormat vertexFormat;
+    glm::vec3 positionScale; // compact positions are multiplied by this, shared by every LOD and mesh group
+    ClusterBounds bounds;
 
     Mesh* nextLOD;
     Mesh* nextMeshGroup;
@@ -70,20 +95,22 @@ struct Mesh
 
     Mesh(void* vertexData, void* elementArrayData, glm::vec3& extents, GLenum drawPrimitive, uint vertexSize, uint numVertices, uint elementSize, uint numElements, uint materialIndex)
     :        
-        vertexData(vertexData),
-        elementArrayData(elementArrayData),
         extents(extents), 
         radius(glm::distance(glm::vec3(0,0,0), extents)),
-        drawPrimitive(drawPrimitive),
-        baseVertex(baseVertex),
-        vertexSize(vertexSize), 
         numVertices(numVertices), 
+        baseVertex(0),
+        vertexData(vertexData),
+        numElements(numElements),
+        elementArrayData(elementArrayData),
+        vertexSize(vertexSize), 
         elementSize(elementSize), 
         elementType(elementSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT),
-        numElements(numElements),
-        materialIndex(materialIndex),
+        drawPrimitive(drawPrimitive),
+        vertexFormat(FULL_VERTEX_FORMAT),
+        positionScale(1.0f),
         nextLOD(0),
-        nextMeshGroup(0)
+        nextMeshGroup(0),
+        materialIndex(materialIndex)
     {
         // Nothing
     }
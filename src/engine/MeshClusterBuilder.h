@@ -0,0 +1,118 @@
+#pragma once
+
+#include "../Utils.h"
+#include "Mesh.h"
+
+// Splits the optimized element arrays of a mesh into clusters of triangles that are culled
+// on their own, and bounds every cluster with a sphere and a cone of normals for the cull shader
+template<class VertexType, class ElementType>
+struct MeshClusterBuilder
+{
+    // Cache size the split points are found with, the same as the optimizer measures with
+    static const uint CACHE_SIZE = 16;
+
+    // Clusters end at a cache restart once they have the minimum, and always at the maximum
+    static const uint MIN_CLUSTER_TRIANGLES = 64;
+    static const uint MAX_CLUSTER_TRIANGLES = 128;
+
+    // Smaller element arrays are left whole, the cull work would outweigh what it saves
+    static const uint MIN_SPLIT_TRIANGLES = 256;
+
+    // Splits the indices along their order, so the vertex cache order is kept within each cluster.
+    // Returns the indices themselves when they are too few to split.
+    static std::vector<std::vector<ElementType>*> split(std::vector<ElementType>* indices, uint numVertices)
+    {
+        std::vector<std::vector<ElementType>*> clusters;
+        uint numTriangles = indices->size() / 3;
+        if(numTriangles < MIN_SPLIT_TRIANGLES)
+        {
+            clusters.push_back(indices);
+            return clusters;
+        }
+
+        std::vector<uint> insertionTime(numVertices, 0);
+        uint time = CACHE_SIZE + 1;
+        std::vector<ElementType>* cluster = new std::vector<ElementType>();
+        for(uint i = 0; i < numTriangles; i++)
+        {
+            uint misses = 0;
+            for(uint j = 0; j < 3; j++)
+            {
+                uint vertex = (*indices)[3*i + j];
+                if(time - insertionTime[vertex] > CACHE_SIZE)
+                {
+                    insertionTime[vertex] = time++;
+                    misses++;
+                }
+            }
+
+            uint clusterTriangles = cluster->size() / 3;
+            if(clusterTriangles == MAX_CLUSTER_TRIANGLES || (misses == 3 && clusterTriangles >= MIN_CLUSTER_TRIANGLES))
+            {
+                clusters.push_back(cluster);
+                cluster = new std::vector<ElementType>();
+            }
+            cluster->insert(cluster->end(), indices->begin() + 3*i, indices->begin() + 3*i + 3);
+        }
+        clusters.push_back(cluster);
+
+        delete indices;
+        return clusters;
+    }
+
+    // The sphere is centered on the middle of the triangles' bounding box. The cone axis is
+    // the average facing of the triangles, and its sine is bounded from the most divergent
+    // one. When some triangle faces 90 degrees or more away from the axis, the cluster can
+    // be seen from any direction and the sine is set above 1.
+    static ClusterBounds computeBounds(const std::vector<VertexType>& vertices, const std::vector<ElementType>& indices)
+    {
+        ClusterBounds bounds;
+        bounds.sphere = glm::vec4(0.0f);
+        bounds.cone = glm::vec4(0.0f, 0.0f, 1.0f, 2.0f);
+        if(indices.empty())
+            return bounds;
+
+        glm::vec3 minPosition = vertices[indices[0]].position;
+        glm::vec3 maxPosition = minPosition;
+        for(uint i = 1; i < indices.size(); i++)
+        {
+            minPosition = glm::min(minPosition, vertices[indices[i]].position);
+            maxPosition = glm::max(maxPosition, vertices[indices[i]].position);
+        }
+        glm::vec3 center = (minPosition + maxPosition) * 0.5f;
+        float radius = 0.0f;
+        for(uint i = 0; i < indices.size(); i++)
+            radius = glm::max(radius, glm::distance(center, vertices[indices[i]].position));
+        bounds.sphere = glm::vec4(center, radius);
+
+        std::vector<glm::vec3> faceNormals;
+        faceNormals.reserve(indices.size() / 3);
+        glm::vec3 axis(0.0f);
+        for(uint i = 0; i + 2 < indices.size(); i += 3)
+        {
+            glm::vec3 a = vertices[indices[i]].position;
+            glm::vec3 b = vertices[indices[i + 1]].position;
+            glm::vec3 c = vertices[indices[i + 2]].position;
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            float length = glm::length(normal);
+            if(length <= 0.0f)
+                continue;
+            faceNormals.push_back(normal / length);
+            axis += faceNormals.back();
+        }
+
+        float axisLength = glm::length(axis);
+        if(axisLength <= 1e-6f)
+            return bounds;
+        axis /= axisLength;
+
+        float minDot = 1.0f;
+        for(uint i = 0; i < faceNormals.size(); i++)
+            minDot = glm::min(minDot, glm::dot(faceNormals[i], axis));
+        if(minDot <= 0.0f)
+            return bounds;
+
+        bounds.cone = glm::vec4(axis, glm::sqrt(1.0f - minDot*minDot));
+        return bounds;
+    }
+};
@@ -53,7 +53,8 @@ struct MeshLibrary
         return meshMap[name];
     }
 
-    Mesh* loadMeshFile(std::string& name, std::string& filename)
+    // Compact meshes store 16 byte vertices instead of 32, see CompactVertex
+    Mesh* loadMeshFile(std::string& name, std::string& filename, bool useCompactVertices = false)
     {
         // Get information from the mesh file to determine which loader to use
 
@@ -81,11 +82,11 @@ struct MeshLibrary
         Mesh* mesh;
         if(headerType == "static" && numVertices < 65536)
         {
-            mesh = staticMeshLoader.loadMeshFile(header, materialLibrary);
+            mesh = staticMeshLoader.loadMeshFile(name, header, materialLibrary, useCompactVertices);
         }
         else if(headerType == "static" && numVertices > 65536)
         {
-            mesh = largeStaticMeshLoader.loadMeshFile(header, materialLibrary);
+            mesh = largeStaticMeshLoader.loadMeshFile(name, header, materialLibrary, useCompactVertices);
         }
 
         insert(name, mesh);
@@ -8,6 +8,8 @@
 #include "RenderData.h"
 #include "MaterialLibrary.h"
 #include "Mesh.h"
+#include "MeshOptimizer.h"
+#include "MeshClusterBuilder.h"
 
 using namespace tinyxml2;
 
@@ -17,16 +19,29 @@ struct MeshLoader
     MeshLoader(){}
     ~MeshLoader(){}
 
-    // meshName == NULL if you don't care to reference this mesh by name
-    Mesh* createMesh(GLenum drawPrimitive, glm::vec3& extents, std::vector<VertexType>* vertexData, std::vector<ElementType>* elementArrayData, uint materialIndex)
+    // compactVertexData is the vertices in the compact format, or 0 to keep the full format
+    Mesh* createMesh(GLenum drawPrimitive, glm::vec3& extents, std::vector<VertexType>* vertexData, std::vector<CompactVertex>* compactVertexData, glm::vec3& positionScale, std::vector<ElementType>* elementArrayData, uint materialIndex)
     {
         // Create the Mesh
         uint numVertices = (*vertexData).size();
-        uint vertexSize = sizeof(VertexType);
+        uint vertexSize = compactVertexData ? sizeof(CompactVertex) : sizeof(VertexType);
+        void* meshVertexData = compactVertexData ? (void*)&(*compactVertexData)[0] : (void*)&(*vertexData)[0];
         uint numElements = (*elementArrayData).size();
         uint elementSize = sizeof(ElementType);
         
-        Mesh* mesh = new Mesh(&(*vertexData)[0], &(*elementArrayData)[0], extents, drawPrimitive, vertexSize, numVertices, elementSize, numElements, materialIndex);
+        Mesh* mesh = new Mesh(meshVertexData, &(*elementArrayData)[0], extents, drawPrimitive, vertexSize, numVertices, elementSize, numElements, materialIndex);
+        if(compactVertexData)
+        {
+            mesh->vertexFormat = COMPACT_VERTEX_FORMAT;
+            mesh->positionScale = positionScale;
+        }
+
+        // The extents in the mesh files are not always centered, so bound the vertices themselves
+        float radius = 0.0f;
+        for(uint i = 0; i < numVertices; i++)
+            radius = glm::max(radius, glm::length((*vertexData)[i].position));
+        mesh->radius = radius;
+        mesh->bounds = MeshClusterBuilder<VertexType, ElementType>::computeBounds(*vertexData, *elementArrayData);
 
         return mesh;
     }
@@ -74,6 +89,45 @@ struct MeshLoader
         return vertices;
     }
 
+    // The largest absolute coordinate along each axis, so that every position fits in [-1, 1] once divided by it
+    glm::vec3 getPositionScale(std::vector<std::vector<VertexType>*>& lodVertices)
+    {
+        glm::vec3 scale(1e-6f);
+        for(uint i = 0; i < lodVertices.size(); i++)
+            for(uint j = 0; j < lodVertices[i]->size(); j++)
+                scale = glm::max(scale, glm::abs((*lodVertices[i])[j].position));
+        return scale;
+    }
+
+    static GLshort toSnorm16(float value)
+    {
+        return (GLshort)glm::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+    }
+
+    std::vector<CompactVertex>* compactVertices(std::vector<VertexType>& vertices, glm::vec3& positionScale)
+    {
+        std::vector<CompactVertex>* compact = new std::vector<CompactVertex>(vertices.size());
+        for(uint i = 0; i < vertices.size(); i++)
+        {
+            glm::vec3 position = vertices[i].position / positionScale;
+            (*compact)[i].position = glm::i16vec4(toSnorm16(position.x), toSnorm16(position.y), toSnorm16(position.z), 0);
+
+            // Project the normal onto the octahedron and fold the lower half over the upper one
+            glm::vec3 normal = vertices[i].normal;
+            normal /= glm::max(glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z), 1e-6f);
+            glm::vec2 octahedral(normal.x, normal.y);
+            if(normal.z < 0.0f)
+            {
+                octahedral.x = (1.0f - glm::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+                octahedral.y = (1.0f - glm::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+            }
+            (*compact)[i].normal = glm::i16vec2(toSnorm16(octahedral.x), toSnorm16(octahedral.y));
+
+            (*compact)[i].UV = glm::hvec2(glm::half(vertices[i].UV.x), glm::half(vertices[i].UV.y));
+        }
+        return compact;
+    }
+
     std::vector<ElementType>* parseElementArrayString(const char* dataString, int count)
     {
         std::vector<ElementType>* elements = new std::vector<ElementType>(count);
@@ -92,7 +146,8 @@ struct MeshLoader
         return elements;
     }
 
-    Mesh* loadMeshFile(XMLElement* meshDoc, MaterialLibrary& materialLibrary)
+    // Compact vertices are quantized to bounds shared by every LOD, so one scale decodes them all
+    Mesh* loadMeshFile(const std::string& meshName, XMLElement* meshDoc, MaterialLibrary& materialLibrary, bool useCompactVertices)
     {
         XMLElement* infoElement = meshDoc->FirstChildElement("info");
 
@@ -108,33 +163,61 @@ struct MeshLoader
         float depth = (float)atof(infoElement->FirstChildElement("depth")->FirstChild()->Value());
         glm::vec3 extents(width/2.0f, height/2.0f, depth/2.0f);
 
-        Mesh* mainMesh = 0;
-        Mesh* currentMeshLOD = 0;
-        Mesh* currentMeshGroup = 0;
-
-        // Loop over the LOD's
+        // Load the vertex data of every LOD
+        std::vector<std::vector<VertexType>*> lodVertices;
         for(XMLElement* geometryElement = meshDoc->FirstChildElement("geometry"); geometryElement != 0; geometryElement = geometryElement->NextSiblingElement("geometry"))
         {
-
-            // Load the vertex data
             XMLElement* vertexDataElement = geometryElement->FirstChildElement("vertex_data");
             int numVertices = atoi(vertexDataElement->Attribute("count"));
             const char* vertexDataString = vertexDataElement->FirstChild()->Value();
-            std::vector<VertexType>* vertexData = parseVertexDataString(vertexDataString, numVertices, containsPositions, containsNormals, containsUVs);
+            lodVertices.push_back(parseVertexDataString(vertexDataString, numVertices, containsPositions, containsNormals, containsUVs));
+        }
+        glm::vec3 positionScale = useCompactVertices ? getPositionScale(lodVertices) : glm::vec3(1.0f);
 
-            // Loop over the element arrays
+        Mesh* mainMesh = 0;
+        Mesh* currentMeshLOD = 0;
+        Mesh* currentMeshGroup = 0;
+
+        // Loop over the LOD's
+        uint lod = 0;
+        for(XMLElement* geometryElement = meshDoc->FirstChildElement("geometry"); geometryElement != 0; geometryElement = geometryElement->NextSiblingElement("geometry"), lod++)
+        {
+            // Load the element arrays
+            std::vector<std::vector<ElementType>*> meshGroupElements;
+            std::vector<uint> meshGroupMaterials;
             for(XMLElement* elementArrayElement = geometryElement->FirstChildElement("element_array"); elementArrayElement != 0; elementArrayElement = elementArrayElement->NextSiblingElement("element_array"))
             {
-                // Load the element array data
                 int numElements = atoi(elementArrayElement->Attribute("count"));
                 const char* elementArrayString = elementArrayElement->FirstChild()->Value();
-                std::vector<ElementType>* elementArrayData = parseElementArrayString(elementArrayString, numElements);
+                meshGroupElements.push_back(parseElementArrayString(elementArrayString, numElements));
                 
                 std::string materialName = elementArrayElement->Attribute("material");
-                uint materialIndex = materialLibrary.getMaterial(materialName);
+                meshGroupMaterials.push_back(materialLibrary.getMaterial(materialName));
+            }
+
+            // Reorder for the vertex cache, overdraw and vertex fetch before the vertices are compacted
+            std::vector<VertexType>* vertexData = lodVertices[lod];
+            MeshOptimizer<VertexType, ElementType>::optimize(meshName, lod, *vertexData, meshGroupElements);
+            std::vector<CompactVertex>* compactVertexData = useCompactVertices ? compactVertices(*vertexData, positionScale) : 0;
 
+            // Split large element arrays into clusters, which become mesh groups of their own so
+            // every cluster gets its own draw command and instance to cull
+            std::vector<std::vector<ElementType>*> clusterElements;
+            std::vector<uint> clusterMaterials;
+            for(uint i = 0; i < meshGroupElements.size(); i++)
+            {
+                std::vector<std::vector<ElementType>*> clusters = MeshClusterBuilder<VertexType, ElementType>::split(meshGroupElements[i], vertexData->size());
+                clusterElements.insert(clusterElements.end(), clusters.begin(), clusters.end());
+                clusterMaterials.insert(clusterMaterials.end(), clusters.size(), meshGroupMaterials[i]);
+            }
+            meshGroupElements.swap(clusterElements);
+            meshGroupMaterials.swap(clusterMaterials);
+
+            // Loop over the element arrays
+            for(uint i = 0; i < meshGroupElements.size(); i++)
+            {
                 // Create the mesh
-                Mesh* meshGroup = createMesh(GL_TRIANGLES, extents, vertexData, elementArrayData, materialIndex);
+                Mesh* meshGroup = createMesh(GL_TRIANGLES, extents, vertexData, compactVertexData, positionScale, meshGroupElements[i], meshGroupMaterials[i]);
 
                 // If the first mesh group has not been processed yet, then this mesh must be the first mesh group
                 // Else if the first mesh group has already been processed, add this mesh to the first's mesh group list
@@ -157,6 +240,10 @@ struct MeshLoader
             }
 
             currentMeshGroup = 0;
+
+            // The full vertices were only needed for the bounds
+            if(compactVertexData)
+                delete vertexData;
         }
 
         // Return the primary mesh
@@ -0,0 +1,318 @@
+#pragma once
+
+#include "../Utils.h"
+
+// Reorders a mesh at load time so that fewer vertices are shaded and fetched:
+// 1) triangles are ordered for the post-transform vertex cache with Tom Forsyth's
+//    linear-speed algorithm
+// 2) the ordered triangles are split into clusters at the points where the cache
+//    starts over, and the clusters are sorted so that the outward facing ones are
+//    drawn first, which cuts overdraw (Sander et al., "Fast triangle reordering")
+// 3) vertices are renumbered in the order they are first used, so vertex fetches walk
+//    the vertex buffer forward
+template<class VertexType, class ElementType>
+struct MeshOptimizer
+{
+    // Size of the LRU cache the triangle order is optimized for
+    static const int OPTIMIZE_CACHE_SIZE = 32;
+
+    // Size of the FIFO cache ACMR and ATVR are measured with
+    static const uint MEASURE_CACHE_SIZE = 16;
+
+    // Clusters for overdraw sorting are at least this many triangles
+    static const uint MIN_CLUSTER_TRIANGLES = 64;
+
+    // Cache misses when the indices are drawn through a FIFO cache
+    static uint countCacheMisses(const std::vector<ElementType>& indices, uint numVertices)
+    {
+        std::vector<uint> insertionTime(numVertices, 0);
+        uint time = MEASURE_CACHE_SIZE + 1;
+        uint misses = 0;
+        for(uint i = 0; i < indices.size(); i++)
+        {
+            uint vertex = indices[i];
+            if(time - insertionTime[vertex] > MEASURE_CACHE_SIZE)
+            {
+                insertionTime[vertex] = time++;
+                misses++;
+            }
+        }
+        return misses;
+    }
+
+    static float vertexScore(int cachePosition, uint remainingTriangles)
+    {
+        if(remainingTriangles == 0)
+            return -1.0f;
+
+        // The last triangle's vertices get a fixed score so its neighbours are preferred
+        float score = 0.0f;
+        if(cachePosition >= 0)
+        {
+            if(cachePosition < 3)
+                score = 0.75f;
+            else
+                score = glm::pow(1.0f - (cachePosition - 3) / float(OPTIMIZE_CACHE_SIZE - 3), 1.5f);
+        }
+
+        // Vertices with few triangles left are finished off first
+        score += 2.0f / glm::sqrt(float(remainingTriangles));
+        return score;
+    }
+
+    static void optimizeVertexCache(std::vector<ElementType>& indices, uint numVertices)
+    {
+        uint numTriangles = indices.size() / 3;
+        if(numTriangles == 0)
+            return;
+
+        // The triangles of every vertex. Each vertex's range shrinks as its triangles are emitted.
+        std::vector<uint> remainingTriangles(numVertices, 0);
+        for(uint i = 0; i < indices.size(); i++)
+            remainingTriangles[indices[i]]++;
+        std::vector<uint> firstTriangle(numVertices + 1, 0);
+        for(uint i = 0; i < numVertices; i++)
+            firstTriangle[i + 1] = firstTriangle[i] + remainingTriangles[i];
+        std::vector<uint> vertexTriangles(indices.size());
+        std::vector<uint> filled(numVertices, 0);
+        for(uint i = 0; i < indices.size(); i++)
+        {
+            uint vertex = indices[i];
+            vertexTriangles[firstTriangle[vertex] + filled[vertex]++] = i / 3;
+        }
+
+        std::vector<int> cachePosition(numVertices, -1);
+        std::vector<float> vertexScores(numVertices);
+        for(uint i = 0; i < numVertices; i++)
+            vertexScores[i] = vertexScore(-1, remainingTriangles[i]);
+
+        std::vector<bool> emitted(numTriangles, false);
+
+        std::vector<ElementType> optimized;
+        optimized.reserve(indices.size());
+        std::vector<uint> cache;
+        std::vector<uint> newCache;
+        uint nextUnemitted = 0;
+        int bestTriangle = -1;
+
+        for(uint emittedTriangles = 0; emittedTriangles < numTriangles; emittedTriangles++)
+        {
+            // Nothing in the cache has triangles left, start again from the first one not emitted
+            if(bestTriangle == -1)
+            {
+                while(emitted[nextUnemitted])
+                    nextUnemitted++;
+                bestTriangle = nextUnemitted;
+            }
+
+            uint triangle = bestTriangle;
+            emitted[triangle] = true;
+            newCache.clear();
+            for(uint i = 0; i < 3; i++)
+            {
+                uint vertex = indices[3*triangle + i];
+                optimized.push_back(indices[3*triangle + i]);
+                newCache.push_back(vertex);
+
+                // Take the triangle out of the vertex's range
+                uint first = firstTriangle[vertex];
+                uint last = first + remainingTriangles[vertex] - 1;
+                for(uint j = first; j <= last; j++)
+                {
+                    if(vertexTriangles[j] == triangle)
+                    {
+                        vertexTriangles[j] = vertexTriangles[last];
+                        break;
+                    }
+                }
+                remainingTriangles[vertex]--;
+            }
+
+            // The triangle's vertices move to the front of the cache, the rest move back
+            for(uint i = 0; i < cache.size(); i++)
+            {
+                uint vertex = cache[i];
+                if(vertex != newCache[0] && vertex != newCache[1] && vertex != newCache[2])
+                    newCache.push_back(vertex);
+            }
+            for(uint i = 0; i < newCache.size(); i++)
+            {
+                uint vertex = newCache[i];
+                cachePosition[vertex] = i < (uint)OPTIMIZE_CACHE_SIZE ? (int)i : -1;
+                vertexScores[vertex] = vertexScore(cachePosition[vertex], remainingTriangles[vertex]);
+            }
+
+            // Rescore the triangles that touch the cache and pick the best one for the next step
+            bestTriangle = -1;
+            float bestScore = -1.0f;
+            for(uint i = 0; i < newCache.size(); i++)
+            {
+                uint vertex = newCache[i];
+                for(uint j = firstTriangle[vertex]; j < firstTriangle[vertex] + remainingTriangles[vertex]; j++)
+                {
+                    uint t = vertexTriangles[j];
+                    float score = vertexScores[indices[3*t]] + vertexScores[indices[3*t + 1]] + vertexScores[indices[3*t + 2]];
+                    if(score > bestScore)
+                    {
+                        bestScore = score;
+                        bestTriangle = t;
+                    }
+                }
+            }
+
+            if(newCache.size() > (uint)OPTIMIZE_CACHE_SIZE)
+                newCache.resize(OPTIMIZE_CACHE_SIZE);
+            cache.swap(newCache);
+        }
+
+        indices.swap(optimized);
+    }
+
+    struct Cluster
+    {
+        uint firstIndex;
+        uint numIndices;
+        float sortKey;
+
+        bool operator<(const Cluster& other) const
+        {
+            return sortKey > other.sortKey;
+        }
+    };
+
+    // Draws the clusters facing out from the mesh's center first. Keeps the cache
+    // order if sorting would add more than 5% cache misses.
+    static void optimizeOverdraw(std::vector<ElementType>& indices, const std::vector<VertexType>& vertices)
+    {
+        uint numTriangles = indices.size() / 3;
+        if(numTriangles < 2*MIN_CLUSTER_TRIANGLES)
+            return;
+
+        // A cluster ends where a triangle misses the cache on all of its vertices
+        std::vector<Cluster> clusters;
+        std::vector<uint> insertionTime(vertices.size(), 0);
+        uint time = MEASURE_CACHE_SIZE + 1;
+        Cluster cluster = {0, 0, 0.0f};
+        for(uint i = 0; i < numTriangles; i++)
+        {
+            uint misses = 0;
+            for(uint j = 0; j < 3; j++)
+            {
+                uint vertex = indices[3*i + j];
+                if(time - insertionTime[vertex] > MEASURE_CACHE_SIZE)
+                {
+                    insertionTime[vertex] = time++;
+                    misses++;
+                }
+            }
+            if(misses == 3 && cluster.numIndices >= 3*MIN_CLUSTER_TRIANGLES)
+            {
+                clusters.push_back(cluster);
+                cluster.firstIndex = 3*i;
+                cluster.numIndices = 0;
+            }
+            cluster.numIndices += 3;
+        }
+        clusters.push_back(cluster);
+        if(clusters.size() < 2)
+            return;
+
+        // Area weighted centroids and normals
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        std::vector<glm::vec3> clusterCentroids(clusters.size(), glm::vec3(0.0f));
+        std::vector<glm::vec3> clusterNormals(clusters.size(), glm::vec3(0.0f));
+        for(uint i = 0; i < clusters.size(); i++)
+        {
+            float clusterArea = 0.0f;
+            for(uint j = clusters[i].firstIndex; j < clusters[i].firstIndex + clusters[i].numIndices; j += 3)
+            {
+                glm::vec3 a = vertices[indices[j]].position;
+                glm::vec3 b = vertices[indices[j + 1]].position;
+                glm::vec3 c = vertices[indices[j + 2]].position;
+                glm::vec3 normal = glm::cross(b - a, c - a);
+                float area = glm::length(normal);
+                clusterCentroids[i] += (a + b + c) / 3.0f * area;
+                clusterNormals[i] += normal;
+                clusterArea += area;
+            }
+            meshCentroid += clusterCentroids[i];
+            meshArea += clusterArea;
+            if(clusterArea > 0.0f)
+                clusterCentroids[i] /= clusterArea;
+        }
+        if(meshArea > 0.0f)
+            meshCentroid /= meshArea;
+
+        for(uint i = 0; i < clusters.size(); i++)
+        {
+            float normalLength = glm::length(clusterNormals[i]);
+            clusters[i].sortKey = normalLength > 0.0f ? glm::dot(clusterCentroids[i] - meshCentroid, clusterNormals[i] / normalLength) : 0.0f;
+        }
+        std::stable_sort(clusters.begin(), clusters.end());
+
+        std::vector<ElementType> sorted;
+        sorted.reserve(indices.size());
+        for(uint i = 0; i < clusters.size(); i++)
+            sorted.insert(sorted.end(), indices.begin() + clusters[i].firstIndex, indices.begin() + clusters[i].firstIndex + clusters[i].numIndices);
+
+        if(countCacheMisses(sorted, vertices.size()) <= countCacheMisses(indices, vertices.size()) * 1.05f)
+            indices.swap(sorted);
+    }
+
+    // Renumbers the vertices of a LOD in the order its mesh groups first use them.
+    // Unused vertices go to the end. Returns the number of used vertices.
+    static uint optimizeVertexFetch(std::vector<VertexType>& vertices, std::vector<std::vector<ElementType>*>& meshGroupIndices)
+    {
+        const uint UNUSED = 0xFFFFFFFF;
+        std::vector<uint> remap(vertices.size(), UNUSED);
+        std::vector<VertexType> reordered;
+        reordered.reserve(vertices.size());
+        for(uint i = 0; i < meshGroupIndices.size(); i++)
+        {
+            std::vector<ElementType>& indices = *meshGroupIndices[i];
+            for(uint j = 0; j < indices.size(); j++)
+            {
+                uint vertex = indices[j];
+                if(remap[vertex] == UNUSED)
+                {
+                    remap[vertex] = reordered.size();
+                    reordered.push_back(vertices[vertex]);
+                }
+                indices[j] = (ElementType)remap[vertex];
+            }
+        }
+        uint numUsedVertices = reordered.size();
+        for(uint i = 0; i < vertices.size(); i++)
+            if(remap[i] == UNUSED)
+                reordered.push_back(vertices[i]);
+        vertices.swap(reordered);
+        return numUsedVertices;
+    }
+
+    // Optimizes one LOD, whose mesh groups all index the same vertices, and prints
+    // the average cache miss ratio per triangle (ACMR) and per vertex (ATVR)
+    static void optimize(const std::string& name, uint lod, std::vector<VertexType>& vertices, std::vector<std::vector<ElementType>*>& meshGroupIndices)
+    {
+        uint numTriangles = 0;
+        uint missesBefore = 0;
+        uint missesAfter = 0;
+        for(uint i = 0; i < meshGroupIndices.size(); i++)
+        {
+            std::vector<ElementType>& indices = *meshGroupIndices[i];
+            numTriangles += indices.size() / 3;
+            missesBefore += countCacheMisses(indices, vertices.size());
+            optimizeVertexCache(indices, vertices.size());
+            optimizeOverdraw(indices, vertices);
+            missesAfter += countCacheMisses(indices, vertices.size());
+        }
+        uint numUsedVertices = optimizeVertexFetch(vertices, meshGroupIndices);
+
+        // ATVR counts only the vertices the triangles reference, the ideal being 1
+        if(numTriangles == 0 || numUsedVertices == 0)
+            return;
+        printf("%s LOD %u: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name.c_str(), lod,
+            missesBefore / float(numTriangles), missesAfter / float(numTriangles),
+            missesBefore / float(numUsedVertices), missesAfter / float(numUsedVertices));
+    }
+};
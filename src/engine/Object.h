@@ -8,6 +8,7 @@
 struct ObjectPosition
 {
     glm::mat4 modelMatrix;
+    glm::vec4 vertexDecode; // .xyz scales the mesh's positions, .w is 1 when its normals are octahedral encoded
 };
 
 struct Object
@@ -22,6 +23,7 @@ struct Object
 
     // Object properties
     GLuint shader;
+    bool castsShadow;
 
     glm::mat4 scaleMatrix;
     glm::mat4 rotationMatrix;
@@ -37,12 +39,14 @@ struct Object
     :
         mesh(mesh),
         shader(shader),
+        castsShadow(true),
         scaleMatrix(1.0f),
         translationMatrix(1.0f),
         rotationMatrix(1.0f),
         rotationQuat(0.0f, 0.0f, 1.0f, 0.0f),
         dirtyPosition(false)
     {
+        position.vertexDecode = glm::vec4(mesh->positionScale, mesh->vertexFormat == COMPACT_VERTEX_FORMAT ? 1.0f : 0.0f);
         updateModelMatrix();
     };
 
@@ -138,6 +142,15 @@ struct Object
         return rotationQuat;
     }
 
+    // Radius of a sphere around the object's origin that holds every mesh group, before scaling
+    float getBoundingRadius()
+    {
+        float radius = 0.0f;
+        for(Mesh* meshGroup = mesh; meshGroup != 0; meshGroup = meshGroup->nextMeshGroup)
+            radius = glm::max(radius, meshGroup->radius);
+        return radius;
+    }
+
     void updateModelMatrix()
     {
         dirtyPosition = true;
@@ -15,11 +15,35 @@ private:
     std::vector<Object*> objects;
     
     // Buffers that store the materials and positions of all the objects
-    UniformBuffer* positionBuffer; // Dynamic GL/CL buffer
-    UniformBuffer* materialBuffer; // Static GL buffer
+    GrowableShaderStorageBuffer* positionBuffer; // Dynamic GL/CL buffer
+    GrowableShaderStorageBuffer* materialBuffer; // Static GL buffer
 
-    // Buffer that store per object information
+    // CPU copy of positionBuffer, and the objects whose positions changed since the last upload
+    std::vector<ObjectPosition> positionArray;
+    std::vector<uint> dirtyObjects;
+
+    // Clean objects between two dirty ones are uploaded with them when there are at most this many,
+    // one longer transfer being cheaper than two small ones
+    static const uint MAX_MERGED_GAP = 4;
+
+    // Buffer that store per object information. It has room for the full instance list
+    // followed by one culled instance list per cull slot.
     PerObjectBufferDynamic* perObjectBufferDynamic;
+    uint meshCount;
+
+    // The draw commands of every render group packed into one indirect buffer, followed by a
+    // copy per cull slot whose instance counts are filled in on the GPU by the cull pass
+    GLuint drawCommandBuffer;
+    GLuint emptyDrawCommandBuffer; // the cull slot copies with no instances, for resetting a slot
+    uint numDrawCommands;
+
+    // Culling inputs: the draw command and LOD of every instance, the bounds and LOD count of every object
+    // and the cluster bounds of every draw command
+    ShaderStorageBuffer* instanceCommandBuffer;
+    ShaderStorageBuffer* objectBoundsBuffer;
+    ShaderStorageBuffer* clusterBoundsBuffer;
+    UniformBuffer* cullBuffer;
+    GLuint cullProgram;
                                 
     // Buffer storage that all Meshes share
     MeshBuffer* meshBuffer;
@@ -51,16 +75,67 @@ private:
         return meshMetaData;
     }
 
+    void uploadPositions(uint first, uint count)
+    {
+        positionBuffer->commitToGL(&positionArray[first], sizeof(ObjectPosition)*count, sizeof(ObjectPosition)*first);
+        positionUploads++;
+        positionUploadBytes += sizeof(ObjectPosition)*count;
+    }
+
 public:
 
+    // Transfers made by the last commitObjectUpdates()
+    uint positionUploads;
+    uint positionUploadBytes;
+
     void begin()
     {
-        // Nothing
+        positionUploads = 0;
+        positionUploadBytes = 0;
+        std::string computeShaderSource = SHADER_DIRECTORY + "instanceCull.comp";
+        cullProgram = Utils::OpenGL::createComputeProgram(computeShaderSource);
     }
 
+    // Only queues the object, commitObjectUpdates() uploads every queued object together
     void updateObject(Object* object)
     {
-        positionBuffer->commitToGL(&object->position.modelMatrix, sizeof(ObjectPosition), sizeof(ObjectPosition)*object->globalIndex);
+        positionArray[object->globalIndex] = object->position;
+        dirtyObjects.push_back(object->globalIndex);
+    }
+
+    // Sorts the queued objects and uploads them as a few contiguous ranges, or as the
+    // whole array when most of the objects changed
+    void commitObjectUpdates()
+    {
+        positionUploads = 0;
+        positionUploadBytes = 0;
+        if(dirtyObjects.empty())
+            return;
+
+        if(dirtyObjects.size()*2 >= positionArray.size())
+        {
+            uploadPositions(0, positionArray.size());
+            dirtyObjects.clear();
+            return;
+        }
+
+        std::sort(dirtyObjects.begin(), dirtyObjects.end());
+        uint rangeStart = dirtyObjects[0];
+        uint rangeEnd = rangeStart + 1;
+        for(uint i = 1; i < dirtyObjects.size(); i++)
+        {
+            uint index = dirtyObjects[i];
+            if(index <= rangeEnd + MAX_MERGED_GAP)
+                rangeEnd = std::max(rangeEnd, index + 1);
+            else
+            {
+                uploadPositions(rangeStart, rangeEnd - rangeStart);
+                rangeStart = index;
+                rangeEnd = index + 1;
+            }
+        }
+        uploadPositions(rangeStart, rangeEnd - rangeStart);
+        dirtyObjects.clear();
     }
 
     void addObject(Object* object)
@@ -126,10 +201,10 @@ public:
         }
     }
 
-    void commitMaterials(void* materialData, uint subBufferSize, uint bufferSize)
+    void commitMaterials(void* materialData, uint bufferSize)
     {
-        materialBuffer = new UniformBuffer(MESH_MATERIAL_ARRAY_BINDING, 0, bufferSize, GL_STATIC_DRAW);
-        materialBuffer->commitToGL(materialData, subBufferSize, 0);
+        materialBuffer = new GrowableShaderStorageBuffer(MESH_MATERIAL_BUFFER_BINDING, bufferSize, GL_STATIC_DRAW);
+        materialBuffer->commitToGL(materialData, bufferSize, 0);
     }
    
     void comitMeshBuffer(uint vertexBufferSize, uint elementArraySize)
@@ -149,7 +224,7 @@ public:
 
     void commitToGL()
     {
-        uint meshCount = 0;
+        meshCount = 0;
         uint globalBaseInstance = 0;
 
         // For each render group ...
@@ -171,7 +246,9 @@ public:
 
         // Now that the number of objects in the scene is known, create the vectors that store object stuff
         std::vector<glm::ivec2>perObjectArrayDynamic(meshCount);
-        std::vector<ObjectPosition> positionArray(objects.size());
+        std::vector<GLuint> instanceLODs(meshCount);
+        std::vector<uint> objectLODCounts(objects.size());
+        positionArray.resize(objects.size());
 
 
         // For every object ...
@@ -183,34 +260,106 @@ public:
             object->globalIndex = objectIndex;
             positionArray[objectIndex] = object->position;
 
-            // Loop over all the mesh groups of the first LOD
-
-            int meshGroupRenderGroup = object->renderGroupID;
-            int meshGroupDrawCommand = object->drawCommandID;
-            while(meshGroupRenderGroup != -1 && meshGroupDrawCommand != -1)
+            // Every LOD gets instances, the cull pass keeps the ones of the LOD that suits the view
+            uint lod = 0;
+            int lodRenderGroup = object->renderGroupID;
+            int lodDrawCommand = object->drawCommandID;
+            for(; lodRenderGroup != -1 && lodDrawCommand != -1; lod++)
             {
-                DrawCommand& drawCommand = renderGroups[meshGroupRenderGroup]->drawCommands[meshGroupDrawCommand];
-                meshGroupRenderGroup = drawCommand.renderGroupIDForNextMeshGroup;
-                meshGroupDrawCommand = drawCommand.drawCommandIDForNextMeshGroup;
-
-                uint baseInstance = drawCommand.baseInstance;
-                uint instanceCount = drawCommand.primCount++;
-                uint globalIndex = baseInstance + instanceCount;
-                uint materialOffset = drawCommand.materialOffset;
-
-                glm::ivec2 perObjectDynamic;
-                perObjectDynamic[POSITION_INDEX] = objectIndex;
-                perObjectDynamic[MATERIAL_INDEX] = materialOffset;
-                perObjectArrayDynamic[globalIndex] = perObjectDynamic;
+                DrawCommand& lodFirstCommand = renderGroups[lodRenderGroup]->drawCommands[lodDrawCommand];
+                int meshGroupRenderGroup = lodRenderGroup;
+                int meshGroupDrawCommand = lodDrawCommand;
+                lodRenderGroup = lodFirstCommand.renderGroupIDForNextLOD;
+                lodDrawCommand = lodFirstCommand.drawCommandIDForNextLOD;
+
+                // Loop over all the mesh groups of the LOD
+                while(meshGroupRenderGroup != -1 && meshGroupDrawCommand != -1)
+                {
+                    DrawCommand& drawCommand = renderGroups[meshGroupRenderGroup]->drawCommands[meshGroupDrawCommand];
+                    meshGroupRenderGroup = drawCommand.renderGroupIDForNextMeshGroup;
+                    meshGroupDrawCommand = drawCommand.drawCommandIDForNextMeshGroup;
+
+                    uint baseInstance = drawCommand.baseInstance;
+                    uint instanceCount = drawCommand.primCount++;
+                    uint globalIndex = baseInstance + instanceCount;
+                    uint materialOffset = drawCommand.materialOffset;
+
+                    glm::ivec2 perObjectDynamic;
+                    perObjectDynamic[POSITION_INDEX] = objectIndex;
+                    perObjectDynamic[MATERIAL_INDEX] = materialOffset;
+                    perObjectArrayDynamic[globalIndex] = perObjectDynamic;
+                    instanceLODs[globalIndex] = lod;
+                }
             }
+            objectLODCounts[objectIndex] = lod;
         }
 
 
         // Create more buffers now that all objects have been processed
-        positionBuffer = new UniformBuffer(POSITION_ARRAY_BINDING, 0, sizeof(ObjectPosition)*NUM_OBJECTS_MAX, GL_STATIC_DRAW); // TO-DO: change to stream once things start moving
+        positionBuffer = new GrowableShaderStorageBuffer(POSITION_BUFFER_BINDING, sizeof(ObjectPosition)*positionArray.size(), GL_DYNAMIC_DRAW);
         positionBuffer->commitToGL(&positionArray[0], sizeof(ObjectPosition)*positionArray.size(), 0);
         
-        perObjectBufferDynamic = new PerObjectBufferDynamic(&perObjectArrayDynamic[0], sizeof(glm::ivec2)*perObjectArrayDynamic.size());
+        perObjectBufferDynamic = new PerObjectBufferDynamic(0, sizeof(glm::ivec2)*meshCount*(1 + MAX_CULL_SLOTS));
+        perObjectBufferDynamic->commitToGL(&perObjectArrayDynamic[0], sizeof(glm::ivec2)*meshCount, 0);
+
+        // Pack the draw commands of every render group together and remember which one each instance belongs to.
+        // A mesh is always at the same LOD, so all the instances of a command share it.
+        std::vector<DrawCommand> allDrawCommands;
+        std::vector<ClusterBounds> allClusterBounds;
+        std::vector<glm::uvec2> instanceCommands(meshCount);
+        for(uint i = 0; i < renderGroups.size(); i++)
+        {
+            RenderGroup* renderGroup = renderGroups[i];
+            renderGroup->firstDrawCommand = allDrawCommands.size();
+            for(uint j = 0; j < renderGroup->drawCommands.size(); j++)
+            {
+                DrawCommand drawCommand = renderGroup->drawCommands[j];
+                for(uint k = 0; k < drawCommand.primCount; k++)
+                    instanceCommands[drawCommand.baseInstance + k] = glm::uvec2(allDrawCommands.size(), instanceLODs[drawCommand.baseInstance + k]);
+
+                // Drawing without culling only draws the finest LOD
+                if(drawCommand.primCount > 0 && instanceLODs[drawCommand.baseInstance] > 0)
+                    drawCommand.primCount = 0;
+                allDrawCommands.push_back(drawCommand);
+                allClusterBounds.push_back(renderGroup->drawCommandBounds[j]);
+            }
+        }
+        numDrawCommands = allDrawCommands.size();
+
+        // Every cull slot's copy draws from the slot's range of the per object buffer
+        std::vector<DrawCommand> emptyDrawCommands;
+        for(uint i = 0; i < MAX_CULL_SLOTS; i++)
+        {
+            for(uint j = 0; j < numDrawCommands; j++)
+            {
+                DrawCommand drawCommand = allDrawCommands[j];
+                drawCommand.baseInstance += meshCount*(1 + i);
+                drawCommand.primCount = 0;
+                emptyDrawCommands.push_back(drawCommand);
+            }
+        }
+
+        glGenBuffers(1, &drawCommandBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand)*numDrawCommands*(1 + MAX_CULL_SLOTS), NULL, GL_DYNAMIC_COPY);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(DrawCommand)*numDrawCommands, &allDrawCommands[0]);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand)*numDrawCommands, sizeof(DrawCommand)*emptyDrawCommands.size(), &emptyDrawCommands[0]);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        glGenBuffers(1, &emptyDrawCommandBuffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, emptyDrawCommandBuffer);
+        glBufferData(GL_COPY_READ_BUFFER, sizeof(DrawCommand)*emptyDrawCommands.size(), &emptyDrawCommands[0], GL_STATIC_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        // Object bounds are the unscaled radius, whether the object casts shadows and its number of LODs
+        std::vector<glm::vec4> objectBounds(objects.size());
+        for(uint i = 0; i < objects.size(); i++)
+            objectBounds[i] = glm::vec4(objects[i]->getBoundingRadius(), objects[i]->castsShadow ? 1.0f : 0.0f, (float)objectLODCounts[i], 0.0f);
+
+        instanceCommandBuffer = new ShaderStorageBuffer(INSTANCE_COMMAND_BUFFER_BINDING, &instanceCommands[0], sizeof(glm::uvec2)*meshCount, GL_STATIC_DRAW);
+        objectBoundsBuffer = new ShaderStorageBuffer(OBJECT_BOUNDS_BUFFER_BINDING, &objectBounds[0], sizeof(glm::vec4)*objects.size(), GL_STATIC_DRAW);
+        clusterBoundsBuffer = new ShaderStorageBuffer(CLUSTER_BOUNDS_BUFFER_BINDING, &allClusterBounds[0], sizeof(ClusterBounds)*numDrawCommands, GL_STATIC_DRAW);
+        cullBuffer = new UniformBuffer(CULL_UBO_BINDING, 0, sizeof(CullUBO), GL_DYNAMIC_DRAW);
 
         // For each render group ...
         for(uint i = 0; i < renderGroups.size(); i++)
@@ -223,18 +372,73 @@ public:
     }
 
 
+    // Draws every instance
     void display()
     {
+        submit(0);
+    }
+
+    // Draws the instances that the last cull() into the slot kept
+    void display(uint cullSlot)
+    {
+        submit(numDrawCommands*(1 + cullSlot));
+    }
+
+    // Tests the bounding sphere of every instance against viewProjection on the GPU, and its cluster's
+    // normal cone against the camera, and writes the visible ones into the cull slot's draw commands.
+    // Nothing is read back to the CPU.
+    // This changes the current program.
+    void cull(const glm::mat4& viewProjection, uint cullSlot, bool shadowCastersOnly)
+    {
+        // Reset the slot's instance counts
+        uint slotSize = sizeof(DrawCommand)*numDrawCommands;
+        glBindBuffer(GL_COPY_READ_BUFFER, emptyDrawCommandBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, drawCommandBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, slotSize*cullSlot, slotSize*(1 + cullSlot), slotSize);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        CullUBO cullData;
+        cullData.uCullViewProjection = viewProjection;
+        cullData.uCullSlot = cullSlot;
+        cullData.uCullShadowCasters = shadowCastersOnly ? 1 : 0;
+        cullData.uNumInstances = meshCount;
+        cullData.uNumDrawCommands = numDrawCommands;
+
+        // The camera is the point the view projection sends to x = y = w = 0. For orthographic
+        // views that point is at infinity, and only the direction towards it is kept.
+        glm::vec4 viewOrigin = glm::inverse(viewProjection) * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+        if(glm::abs(viewOrigin.w) > 1e-6f)
+            cullData.uCullViewOrigin = glm::vec4(glm::vec3(viewOrigin) / viewOrigin.w, 1.0f);
+        else
+            cullData.uCullViewOrigin = glm::vec4(-glm::normalize(glm::vec3(viewOrigin)), 0.0f);
+        cullBuffer->commitToGL(&cullData, sizeof(CullUBO), 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BUFFER_BINDING, perObjectBufferDynamic->bufferObject);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COMMAND_BUFFER_BINDING, drawCommandBuffer);
+        Utils::OpenGL::useProgram(cullProgram);
+        glDispatchCompute((meshCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+
+private:
+
+    void submit(uint baseDrawCommand)
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommandBuffer);
         for(uint i = 0; i < renderGroups.size(); i++)
         {
             RenderGroup* renderGroup = renderGroups[i];
             if(!renderGroup->disabled)
             {
-                renderGroup->render(true);
+                renderGroup->render(true, baseDrawCommand);
             }
         }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
     }
 
+public:
+
     ~RenderData()
     {
 
@@ -10,6 +10,8 @@ struct DrawElements
 };
 
 
+// Starts with the layout of an indirect elements draw, the helper fields after it are
+// skipped with the stride when the commands are submitted
 struct DrawCommand
 {
     // Draw elements
@@ -35,11 +37,13 @@ struct RenderGroup
 
     // Draw commands
     std::vector<DrawCommand> drawCommands;
+    std::vector<ClusterBounds> drawCommandBounds; // bounds of each draw command's mesh
 
     int meshCount; // Updates in addObject
         
     // Properties that distinguish this render group
     int vertexSize;
+    VertexFormat vertexFormat;
     int elementSize;
     GLenum elementType;
     GLenum drawPrimitive;
@@ -48,11 +52,15 @@ struct RenderGroup
     // Vertex array object built from the render group's properties
     GLuint vertexArrayObject;
 
+    // Where this group's draw commands start in the indirect buffer shared by all groups
+    uint firstDrawCommand;
+
     bool disabled;
 
     RenderGroup(Object* object, Mesh* mesh, uint ID)
     :
         vertexSize(mesh->vertexSize),
+        vertexFormat(mesh->vertexFormat),
         elementSize(mesh->elementSize),
         elementType(mesh->elementType),
         drawPrimitive(mesh->drawPrimitive),
@@ -112,6 +120,7 @@ struct RenderGroup
 
             drawCommandIndex = drawCommands.size();
             drawCommands.push_back(drawCommand);
+            drawCommandBounds.push_back(mesh->bounds);
         }
 
         MeshMetaData meshMetaData;
@@ -131,7 +140,7 @@ struct RenderGroup
 
         // Generate the vertex array object
         glGenVertexArrays(1, &vertexArrayObject);
-        glBindVertexArray(vertexArrayObject);
+        Utils::OpenGL::bindVertexArray(vertexArrayObject);
 
         // Add the array buffer to the state of the vertex array object
         glBindBuffer(GL_ARRAY_BUFFER, meshBuffer->vertexBufferObject);
@@ -145,12 +154,25 @@ struct RenderGroup
 
         // Set the vertex attribute pointers. The vertex attributes are interleaved
         int offset = 0;
-        glVertexAttribPointer(POSITION_ATTR, 3, GL_FLOAT, GL_FALSE, vertexSize, (void*)(offset));
-        offset += 3*sizeof(float);
-        glVertexAttribPointer(NORMAL_ATTR, 3, GL_FLOAT, GL_FALSE, vertexSize, (void*)(offset));
-        offset += 3*sizeof(float);
-        glVertexAttribPointer(UV_ATTR, 2, GL_FLOAT, GL_FALSE, vertexSize, (void*)(offset));
-        offset += 2*sizeof(float);
+        if(vertexFormat == COMPACT_VERTEX_FORMAT)
+        {
+            // The vertex shaders scale the positions and decode the octahedral normals
+            glVertexAttribPointer(POSITION_ATTR, 3, GL_SHORT, GL_TRUE, vertexSize, (void*)(offset));
+            offset += 4*sizeof(GLshort);
+            glVertexAttribPointer(NORMAL_ATTR, 2, GL_SHORT, GL_TRUE, vertexSize, (void*)(offset));
+            offset += 2*sizeof(GLshort);
+            glVertexAttribPointer(UV_ATTR, 2, GL_HALF_FLOAT, GL_FALSE, vertexSize, (void*)(offset));
+            offset += 2*sizeof(GLhalf);
+        }
+        else
+        {
+            glVertexAttribPointer(POSITION_ATTR, 3, GL_FLOAT, GL_FALSE, vertexSize, (void*)(offset));
+            offset += 3*sizeof(float);
+            glVertexAttribPointer(NORMAL_ATTR, 3, GL_FLOAT, GL_FALSE, vertexSize, (void*)(offset));
+            offset += 3*sizeof(float);
+            glVertexAttribPointer(UV_ATTR, 2, GL_FLOAT, GL_FALSE, vertexSize, (void*)(offset));
+            offset += 2*sizeof(float);
+        }
 
         // Bind and point to the object index buffer
         glBindBuffer(GL_ARRAY_BUFFER, perObjectBufferDynamic->bufferObject);
@@ -161,33 +183,30 @@ struct RenderGroup
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshBuffer->elementArrayBufferObject);
 
         //Unbind everything
-        glBindVertexArray(0);
+        Utils::OpenGL::bindVertexArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     }
 
-    void render(bool shaderOverride)
+    // Submits every draw command with a single call. The shared indirect buffer must be bound,
+    // and the commands are read from baseDrawCommand on, which picks the full or a culled list.
+    void render(bool shaderOverride, uint baseDrawCommand)
     {
         if(!shaderOverride)
         {
-            glUseProgram(shader);
-        }
-
-        glBindVertexArray(vertexArrayObject);
-
-        for(uint i = 0; i < drawCommands.size(); i++)
-        {
-            DrawCommand& drawCommand = drawCommands[i];
-            glDrawElementsInstancedBaseVertexBaseInstance(drawPrimitive, drawCommand.count, elementType, (void*)(drawCommand.firstIndex*elementSize), drawCommand.primCount, drawCommand.baseVertex, drawCommand.baseInstance);
+            Utils::OpenGL::useProgram(shader);
         }
 
-        glBindVertexArray(0);
+        uint offset = sizeof(DrawCommand)*(baseDrawCommand + firstDrawCommand);
+        Utils::OpenGL::bindVertexArray(vertexArrayObject);
+        glMultiDrawElementsIndirect(drawPrimitive, elementType, (void*)offset, drawCommands.size(), sizeof(DrawCommand));
     }
         
     bool isMeshCompatible(Object* object, Mesh* mesh)
     {
         return  elementSize == mesh->elementSize &&
                 vertexSize == mesh->vertexSize &&
+                vertexFormat == mesh->vertexFormat &&
                 drawPrimitive == mesh->drawPrimitive &&
                 shader == object->shader;
     }
@@ -14,10 +14,10 @@ struct Scene
     glm::vec3 minBounds;
     glm::vec3 maxBounds;
     float radius;
+    uint geometryRevision; // bumped whenever an object other than the light marker moves
 
-    Scene()
+    Scene() : geometryRevision(0)
     {
-        // Nothing
     }
 
     ~Scene()
@@ -81,6 +81,7 @@ struct Scene
 
     void display(RenderData& renderData)
     {
+        bool geometryChanged = false;
         for(uint i = 0; i < objects.size(); i++)
         {
             Object* object = objects[i];
@@ -89,8 +90,14 @@ struct Scene
                 // No longer dirty
                 object->dirtyPosition = false;
                 renderData.updateObject(object);
+                if(object != lightObject)
+                    geometryChanged = true;
             }
         }
 
+        renderData.commitObjectUpdates();
+
+        if(geometryChanged)
+            geometryRevision++;
     }
 };
\ No newline at end of file
@@ -85,13 +85,13 @@ struct SceneLibrary
 
         scene->setBounds(bottomCorner, topCorner);
 
-        // Loop over meshes and load them
+        // Loop over meshes and load them. Meshes marked compact="true" use the compact vertex format.
         XMLElement* meshesElement = header->FirstChildElement("meshes");
         for(XMLElement* meshElement = meshesElement->FirstChildElement("mesh"); meshElement != 0; meshElement = meshElement->NextSiblingElement("mesh"))
         {
             std::string meshName = meshElement->Attribute("name");
             std::string meshFilename = MESH_DIRECTORY + meshName + ".xml";
-            meshLibrary.loadMeshFile(meshName, meshFilename);
+            meshLibrary.loadMeshFile(meshName, meshFilename, meshElement->BoolAttribute("compact"));
         }
 
         // Load light mesh
@@ -101,6 +101,7 @@ struct SceneLibrary
 
         // Create light object
         Object* lightObject = new Object(lightMesh, shaderLibrary.voxelDebugShader);
+        lightObject->castsShadow = false;
         scene->addObject(renderData, lightObject);
         scene->lightObject = lightObject;
         
@@ -134,6 +135,11 @@ struct SceneLibrary
             glm::vec4 rotation = getRotation(rotateElement);
             object->rotate(glm::vec3(rotation), rotation.w); 
 
+            // Objects cast shadows unless told otherwise
+            XMLElement* shadowElement = objectElement->FirstChildElement("shadow");
+            if(shadowElement)
+                object->castsShadow = std::string(shadowElement->FirstChild()->Value()) == "true";
+
             scene->addObject(renderData, object);
         }
 
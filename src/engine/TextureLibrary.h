@@ -106,7 +106,7 @@ struct TextureLibrary
 		// Create the texture sampler
 		GLuint textureSampler;
 		glGenSamplers(1, &textureSampler);
-        glBindSampler(NON_USED_TEXTURE, textureSampler);
+        Utils::OpenGL::bindSampler(NON_USED_TEXTURE, textureSampler);
         glSamplerParameteri(textureSampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glSamplerParameteri(textureSampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
@@ -118,7 +118,7 @@ struct TextureLibrary
             // Set active texture and bind texture
             glActiveTexture(GL_TEXTURE0 + DIFFUSE_TEXTURE_ARRAY_SAMPLER_BINDING[i]);
             glBindTexture(GL_TEXTURE_2D_ARRAY, textureArraysGL[i]);
-			glBindSampler(DIFFUSE_TEXTURE_ARRAY_SAMPLER_BINDING[i], textureSampler);
+			Utils::OpenGL::bindSampler(DIFFUSE_TEXTURE_ARRAY_SAMPLER_BINDING[i], textureSampler);
 
             // Get the gli format to a proper opengl format
             GLuint textureInternalformat;
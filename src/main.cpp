@@ -6,6 +6,11 @@
 #include "MipMapGenerator.h"
 #include "VoxelClean.h"
 #include "ShadowMap.h"
+#include "IrradianceProbes.h"
+#include "DistanceField.h"
+#include "LightInjection.h"
+#include "VoxelBounce.h"
+#include "FrameGraph.h"
 #include "engine/CoreEngine.h"
 #include "demos/VoxelDebug.h"
 #include "demos/VoxelRaycaster.h"
@@ -18,7 +23,7 @@ namespace
     // Window
     std::string applicationName("Sparse Texture Voxels");
     glm::ivec2 windowSize(800, 533);
-    glm::ivec2 openGLVersion(4, 2);
+    glm::ivec2 openGLVersion(4, 3);
     bool enableMousePicking = true;
     bool showDebugOutput = false;
     bool showFPS = true;
@@ -28,11 +33,19 @@ namespace
     std::string sceneFile = SCENE_DIRECTORY + "sponza.xml";
     uint voxelGridLength = 256;
     float voxelRegionWorldSize = 100.0f;
-    uint shadowMapResolution = 1024;
+    uint shadowMapResolution = 512; // per cascade
+    uint probeGridLength = 32;
+    uint probeSlicesPerFrame = 2;
     uint numMipMapLevels = 6; // If 0, then calculate the number based on the grid length
+    uint distanceFieldMipLevel = 1; // 0 builds the distance field at full voxel resolution, 1 at half
+    bool useDistanceField = true;
+    bool useVoxelBounce = false;
+    bool useConeShadows = false;
+    uint bounceBricksPerFrame = 1024; // out of 32768 for a 256 grid
     uint currentMipMapLevel = 0;
     float specularFOV = 5.0f;
     float specularAmount = 0.1f;
+    QualityLevel currentQualityLevel = QUALITY_HIGH;
 
     // Demo settings
     bool loadAllDemos = true;
@@ -50,6 +63,8 @@ namespace
     const float FRAME_TIME_DELTA = 0.01f;
     glm::ivec2 mouseClickPos;
     glm::ivec2 currentMousePos;
+    glm::mat4 previousViewProjection;
+    int frameIndex = 0;
     Object* currentSelectedObject;
     FirstPersonCamera* viewCamera = new FirstPersonCamera();
     ThirdPersonCamera* lightCamera = new ThirdPersonCamera();
@@ -57,7 +72,11 @@ namespace
     Camera* currentCamera = viewCamera;
     VoxelTexture* voxelTexture = new VoxelTexture();
     Voxelizer* voxelizer = new Voxelizer();
+    LightInjection* lightInjection = new LightInjection();
+    VoxelBounce* voxelBounce = new VoxelBounce();
     VoxelClean* voxelClean = new VoxelClean();
+    IrradianceProbes* irradianceProbes = new IrradianceProbes();
+    DistanceField* distanceField = new DistanceField();
     MipMapGenerator* mipMapGenerator = new MipMapGenerator();
     Utils::OpenGL::OpenGLTimer* timer = new Utils::OpenGL::OpenGLTimer();
     CoreEngine* coreEngine = new CoreEngine();
@@ -65,7 +84,17 @@ namespace
     Passthrough* passthrough = new Passthrough();
     ShadowMap* shadowMap = new ShadowMap();
     PerFrameUBO* perFrame = new PerFrameUBO();
-    GLuint perFrameUBO;
+    PerViewUBO* perView = new PerViewUBO();
+    PerPassUBO* perPass = new PerPassUBO();
+    UniformRingBuffer* uniformRing;
+
+    // Frame graph
+    FrameGraph* frameGraph = new FrameGraph();
+    uint backbufferResource;
+    uint bouncePass;
+    uint distanceFieldPass;
+    uint demoPasses[MAX_DEMO_TYPES];
+    bool lightInjected = false;
 }
 
 void GLFWCALL mouseMove(int x, int y)
@@ -157,6 +186,56 @@ void GLFWCALL keyPress(int k, int action)
         // Enable linear sampling
         if (k == 'L') voxelTexture->changeSamplerType();
 
+        // Cycle through the cone tracing quality presets
+        if (k == 'P')
+        {
+            currentQualityLevel = (QualityLevel)((currentQualityLevel + 1) % MAX_QUALITY_LEVELS);
+            printf("Quality preset: %s\n", QUALITY_PRESETS[currentQualityLevel].name);
+            if (loadAllDemos || currentDemoType == VOXELCONETRACER)
+                voxelConetracer->setQualityPreset(QUALITY_PRESETS[currentQualityLevel]);
+            if (loadAllDemos || currentDemoType == MAIN_RENDERER)
+                mainRenderer->setQualityPreset(QUALITY_PRESETS[currentQualityLevel]);
+        }
+
+        // Sphere tracing with the voxel distance field
+        if (k == 'J')
+        {
+            useDistanceField = !useDistanceField;
+            printf("Distance field: %s\n", useDistanceField ? "on" : "off");
+            if (loadAllDemos || currentDemoType == VOXELRAYCASTER)
+                voxelRaycaster->setDistanceField(useDistanceField);
+            if (loadAllDemos || currentDemoType == VOXELCONETRACER)
+                voxelConetracer->setDistanceField(useDistanceField);
+        }
+
+        // Switch between building the distance field on the GPU and the CPU
+        if (k == 'K')
+        {
+            distanceField->changeGenerationType();
+            printf("Distance field generation: %s\n", distanceField->currentGenerationType == DistanceField::JUMP_FLOOD_GPU ? "GPU jump flood" : "CPU exact");
+        }
+
+        // Multi-bounce light in the voxels
+        if (k == 'B')
+        {
+            useVoxelBounce = !useVoxelBounce;
+            printf("Voxel bounce: %s\n", useVoxelBounce ? "on" : "off");
+            lightInjection->setBounce(useVoxelBounce);
+        }
+
+        // Voxel cone traced shadows instead of the shadow map
+        if (k == 'V')
+        {
+            useConeShadows = !useConeShadows;
+            printf("Shadows: %s\n", useConeShadows ? "voxel cones" : "shadow map");
+            lightInjection->setConeShadows(useConeShadows);
+            if (loadAllDemos || currentDemoType == MAIN_RENDERER)
+                mainRenderer->setConeShadows(useConeShadows);
+        }
+
+        // Print the GPU time of every pass in the frame graph
+        if (k == 'I') frameGraph->printTimings();
+
         //Switch between light and regular camera
         if (k == GLFW_KEY_SPACE)
         {
@@ -212,12 +291,32 @@ void GLFWCALL resize(int w, int h)
     viewCamera->setAspectRatio(w, h);
     observerCamera->setAspectRatio(w, h);
     windowSize = glm::ivec2(w, h);
+    if (loadAllDemos || currentDemoType == MAIN_RENDERER)
+        mainRenderer->resize(w, h);
+}
+
+// True when every object is inside the voxel region, so nothing needs the shadow map
+bool voxelRegionCoversScene()
+{
+    glm::vec3 regionMin = glm::vec3(perFrame->uVoxelRegionWorld);
+    glm::vec3 regionMax = regionMin + perFrame->uVoxelRegionWorld.w;
+    Scene* scene = coreEngine->scene;
+    return glm::all(glm::lessThanEqual(regionMin, scene->minBounds)) && glm::all(glm::greaterThanEqual(regionMax, scene->maxBounds));
+}
+
+// Passes that render other views or step through levels bind their own blocks,
+// this puts back the camera's before a demo draws
+void setViewUBO()
+{
+    uniformRing->commitToGL(PER_VIEW_UBO_BINDING, perView, sizeof(PerViewUBO));
+    uniformRing->commitToGL(PER_PASS_UBO_BINDING, perPass, sizeof(PerPassUBO));
 }
 
 void setUBO()
 {
     // Update the per frame UBO
-    perFrame->uViewProjection = currentCamera->createPerspectiveProjectionMatrix() * currentCamera->createViewMatrix();    
+    perView->uViewProjection = currentCamera->createPerspectiveProjectionMatrix() * currentCamera->createViewMatrix();    
+    perFrame->uInvViewProjection = glm::inverse(perView->uViewProjection);
     perFrame->uCamLookAt = currentCamera->lookAt;
     perFrame->uCamPos = currentCamera->position;
     perFrame->uCamUp = currentCamera->upDir;
@@ -234,16 +333,18 @@ void setUBO()
     perFrame->uNumMips = (float)voxelTexture->numMipMapLevels;
     perFrame->uSpecularFOV = specularFOV;
     perFrame->uSpecularAmount = specularAmount;
-    perFrame->uCurrentMipLevel = currentMipMapLevel;
+    perFrame->uPrevViewProjection = previousViewProjection;
+    perFrame->uFrameIndex = frameIndex;
+    perPass->uCurrentMipLevel = currentMipMapLevel;
 
-    glBindBuffer(GL_UNIFORM_BUFFER, perFrameUBO);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameUBO), perFrame);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    uniformRing->commitToGL(PER_FRAME_UBO_BINDING, perFrame, sizeof(PerFrameUBO));
+    setViewUBO();
 }
 
 void initGL()
 {
     gl3wInit();
+    loadOpenGLExtensions();
 
     // Debug output
     if(showDebugOutput && Utils::OpenGL::checkExtension("GL_ARB_debug_output"))
@@ -257,12 +358,9 @@ void initGL()
     }
     else printf("debug output extension not found or disabled\n");
     
-    // Create per frame uniform buffer object
-    glGenBuffers(1, &perFrameUBO);
-    glBindBuffer(GL_UNIFORM_BUFFER, perFrameUBO);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(PerFrameUBO), NULL, GL_STREAM_DRAW);
-    glBindBufferBase(GL_UNIFORM_BUFFER, PER_FRAME_UBO_BINDING, perFrameUBO);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    // Create the ring the per frame, per view and per pass blocks are streamed through.
+    // A frame makes a few dozen uploads at most (mip levels and jump flood passes included).
+    uniformRing = new UniformRingBuffer(64*1024);
 
     // Backface culling
     glFrontFace(GL_CCW);
@@ -295,7 +393,177 @@ void initCameras()
     lightCamera->lookAt = glm::vec3(0.5f);
     lightCamera->rotate(-1.52f,-0.27f);
     lightCamera->zoom(0.8f);
-    
+
+}
+
+// Frame graph passes. Each returns whether it wrote its outputs this frame.
+
+bool shadowPass()
+{
+    // Cone traced shadows don't read the shadow map when the voxels hold the whole scene,
+    // otherwise they only leave out the cascades of the view inside the voxel region
+    bool coneShadows = currentDemoType != TRIANGLE_DEBUG && useConeShadows;
+    if (coneShadows && voxelRegionCoversScene())
+    {
+        shadowMap->updateLight();
+        return false;
+    }
+    shadowMap->display(coneShadows);
+    return true;
+}
+
+bool voxelCleanPass()
+{
+    if (!voxelizer->isOutOfDate())
+        return false;
+    voxelClean->clean();
+    return true;
+}
+
+bool voxelizePass()
+{
+    if (!voxelizer->isOutOfDate())
+        return false;
+    voxelizer->voxelizeScene();
+    return true;
+}
+
+bool voxelBouncePass()
+{
+    voxelBounce->update();
+    return true;
+}
+
+bool lightInjectionPass()
+{
+    lightInjected = lightInjection->update();
+    return lightInjected;
+}
+
+bool mipMapPass()
+{
+    if (!lightInjected)
+        return false;
+    mipMapGenerator->generateMipMapGPU();
+    return true;
+}
+
+bool irradianceProbePass()
+{
+    irradianceProbes->update();
+    return true;
+}
+
+bool distanceFieldUpdatePass()
+{
+    return distanceField->update();
+}
+
+bool voxelDebugPass()
+{
+    voxelDebug->display();
+    return true;
+}
+
+bool triangleDebugPass()
+{
+    setViewUBO();
+    triangleDebug->display();
+    return true;
+}
+
+bool voxelRaycasterPass()
+{
+    setViewUBO();
+    voxelRaycaster->display();
+    return true;
+}
+
+bool voxelConetracerPass()
+{
+    setViewUBO();
+    voxelConetracer->display();
+    return true;
+}
+
+bool mainRendererPass()
+{
+    setViewUBO();
+    mainRenderer->display(perView->uViewProjection);
+
+    // Keep this frame's camera for reprojecting next frame
+    previousViewProjection = perView->uViewProjection;
+    frameIndex++;
+    return true;
+}
+
+// Declares what every pass reads and writes. The demo draws to the backbuffer and
+// the graph only runs the passes that lead to it.
+void buildFrameGraph()
+{
+    uint shadowMapResource = frameGraph->addResource("shadow map");
+    uint voxelSurfaceResource = frameGraph->addResource("voxel albedo and normal");
+    uint voxelBounceResource = frameGraph->addResource("voxel bounce");
+    uint voxelColorResource = frameGraph->addResource("voxel color");
+    uint probeResource = frameGraph->addResource("irradiance probes");
+    uint distanceFieldResource = frameGraph->addResource("distance field");
+    backbufferResource = frameGraph->addResource("backbuffer");
+
+    uint pass = frameGraph->addPass("shadow map", shadowPass);
+    frameGraph->write(pass, shadowMapResource, ACCESS_IMAGE);
+
+    pass = frameGraph->addPass("voxel clean", voxelCleanPass);
+    frameGraph->write(pass, voxelSurfaceResource, ACCESS_IMAGE);
+
+    pass = frameGraph->addPass("voxelize", voxelizePass);
+    frameGraph->write(pass, voxelSurfaceResource, ACCESS_IMAGE);
+
+    // Reads the previous frame's light, before it is injected again
+    bouncePass = frameGraph->addPass("voxel bounce", voxelBouncePass);
+    frameGraph->read(bouncePass, voxelSurfaceResource, ACCESS_IMAGE);
+    frameGraph->read(bouncePass, voxelColorResource, ACCESS_TEXTURE);
+    frameGraph->write(bouncePass, voxelBounceResource, ACCESS_IMAGE);
+
+    pass = frameGraph->addPass("light injection", lightInjectionPass);
+    frameGraph->read(pass, voxelSurfaceResource, ACCESS_IMAGE);
+    frameGraph->read(pass, shadowMapResource, ACCESS_TEXTURE);
+    frameGraph->read(pass, voxelBounceResource, ACCESS_TEXTURE);
+    frameGraph->read(pass, voxelColorResource, ACCESS_TEXTURE);
+    frameGraph->write(pass, voxelColorResource, ACCESS_IMAGE);
+
+    pass = frameGraph->addPass("mip maps", mipMapPass);
+    frameGraph->read(pass, voxelColorResource, ACCESS_TEXTURE);
+    frameGraph->write(pass, voxelColorResource, ACCESS_IMAGE);
+
+    pass = frameGraph->addPass("irradiance probes", irradianceProbePass);
+    frameGraph->read(pass, voxelColorResource, ACCESS_TEXTURE);
+    frameGraph->write(pass, probeResource, ACCESS_IMAGE);
+
+    distanceFieldPass = frameGraph->addPass("distance field", distanceFieldUpdatePass);
+    frameGraph->read(distanceFieldPass, voxelColorResource, ACCESS_TEXTURE);
+    frameGraph->write(distanceFieldPass, distanceFieldResource, ACCESS_IMAGE);
+
+    // The voxel debug view reads its own copy of the voxels, refreshed when it is picked
+    demoPasses[VOXEL_DEBUG] = frameGraph->addPass("voxel debug", voxelDebugPass);
+
+    demoPasses[TRIANGLE_DEBUG] = frameGraph->addPass("triangle debug", triangleDebugPass);
+    frameGraph->read(demoPasses[TRIANGLE_DEBUG], shadowMapResource, ACCESS_TEXTURE);
+
+    demoPasses[VOXELRAYCASTER] = frameGraph->addPass("voxel raycaster", voxelRaycasterPass);
+    demoPasses[VOXELCONETRACER] = frameGraph->addPass("voxel conetracer", voxelConetracerPass);
+    for (uint i = VOXELRAYCASTER; i <= VOXELCONETRACER; i++)
+    {
+        frameGraph->read(demoPasses[i], voxelColorResource, ACCESS_TEXTURE);
+        frameGraph->read(demoPasses[i], distanceFieldResource, ACCESS_TEXTURE);
+    }
+
+    demoPasses[MAIN_RENDERER] = frameGraph->addPass("main renderer", mainRendererPass);
+    frameGraph->read(demoPasses[MAIN_RENDERER], shadowMapResource, ACCESS_TEXTURE);
+    frameGraph->read(demoPasses[MAIN_RENDERER], voxelColorResource, ACCESS_TEXTURE);
+    frameGraph->read(demoPasses[MAIN_RENDERER], probeResource, ACCESS_TEXTURE);
+
+    for (uint i = 0; i < MAX_DEMO_TYPES; i++)
+        frameGraph->write(demoPasses[i], backbufferResource, ACCESS_FRAMEBUFFER);
 }
 
 void begin()
@@ -311,9 +579,13 @@ void begin()
     passthrough->begin(coreEngine);
     voxelTexture->begin(voxelGridLength, numMipMapLevels);
     voxelClean->begin(voxelTexture, fullScreenQuad);
-    voxelizer->begin(voxelTexture, coreEngine, viewCamera, perFrame, perFrameUBO);
-    mipMapGenerator->begin(voxelTexture, fullScreenQuad, perFrame, perFrameUBO);
-    shadowMap->begin(shadowMapResolution, coreEngine, fullScreenQuad, lightCamera, perFrame, perFrameUBO);
+    voxelizer->begin(voxelTexture, coreEngine, viewCamera, perFrame, uniformRing);
+    lightInjection->begin(voxelTexture, perFrame);
+    voxelBounce->begin(voxelTexture, bounceBricksPerFrame, uniformRing);
+    mipMapGenerator->begin(voxelTexture, fullScreenQuad, uniformRing);
+    shadowMap->begin(shadowMapResolution, coreEngine, fullScreenQuad, lightCamera, perFrame, uniformRing);
+    irradianceProbes->begin(coreEngine, fullScreenQuad, probeGridLength, probeSlicesPerFrame, perFrame, uniformRing);
+    distanceField->begin(voxelTexture, distanceFieldMipLevel, uniformRing);
 
     // init demos
     if (loadAllDemos || currentDemoType == VOXEL_DEBUG) 
@@ -321,47 +593,33 @@ void begin()
     if (loadAllDemos || currentDemoType == TRIANGLE_DEBUG)
         triangleDebug->begin(coreEngine);
     if (loadAllDemos || currentDemoType == VOXELRAYCASTER)
-        voxelRaycaster->begin(voxelTexture, fullScreenQuad);
+        voxelRaycaster->begin(voxelTexture, fullScreenQuad, useDistanceField);
     if (loadAllDemos || currentDemoType == VOXELCONETRACER)
-        voxelConetracer->begin(voxelTexture, fullScreenQuad);
+        voxelConetracer->begin(voxelTexture, fullScreenQuad, QUALITY_PRESETS[currentQualityLevel], useDistanceField);
     if (loadAllDemos || currentDemoType == MAIN_RENDERER)
-        mainRenderer->begin(coreEngine, passthrough);
+        mainRenderer->begin(coreEngine, passthrough, fullScreenQuad, QUALITY_PRESETS[currentQualityLevel], useConeShadows, windowSize.x, windowSize.y);
+
+    buildFrameGraph();
 }
 
 void display()
 {
+    uniformRing->beginFrame();
+    Utils::OpenGL::beginStateCacheFrame();
+
     // blank slate
     Utils::OpenGL::clearColorAndDepth();
     setUBO();
     updateLightObject();
     coreEngine->updateScene();
 
-    // Display demo
-    if (currentDemoType == VOXEL_DEBUG)
-        voxelDebug->display();
-    else if (currentDemoType == TRIANGLE_DEBUG)
-    {
-        shadowMap->display();
-        //voxelClean->clean();
-        //voxelizer->voxelizeScene();
-        //setUBO();
-        triangleDebug->display();
-        //voxelDebug->voxelTextureUpdate();
-        //voxelDebug->display();
-    }
-    else if (currentDemoType == VOXELRAYCASTER)
-        voxelRaycaster->display(); 
-    else if (currentDemoType == VOXELCONETRACER)  
-        voxelConetracer->display();
-    else if (currentDemoType == MAIN_RENDERER) {
-        // Update the scene
-        shadowMap->display();
-        voxelClean->clean();
-        voxelizer->voxelizeScene();
-        mipMapGenerator->generateMipMapGPU();
-        setUBO();
-        mainRenderer->display(); 
-    }
+    // Display demo, along with the passes it depends on
+    for (uint i = 0; i < MAX_DEMO_TYPES; i++)
+        frameGraph->setEnabled(demoPasses[i], i == currentDemoType);
+    frameGraph->setEnabled(bouncePass, useVoxelBounce);
+    frameGraph->setEnabled(distanceFieldPass, useDistanceField);
+    lightInjected = false;
+    frameGraph->execute(backbufferResource);
 }
 
 void displayFPS()
@@ -372,6 +630,12 @@ void displayFPS()
     {
         std::ostringstream ss;
         ss << applicationName << " (fps: " << (frameCount/currentTime) << " )";
+        if (useVoxelBounce && currentDemoType == MAIN_RENDERER)
+            ss << " (bounce: " << frameGraph->getElapsedMilliseconds(bouncePass) << " ms)";
+        if (currentDemoType == MAIN_RENDERER)
+            ss << " (shadows: " << (useConeShadows ? "voxel cones" : "shadow map") << ")";
+        ss << " (transforms: " << coreEngine->getPositionUploads() << " uploads, " << coreEngine->getPositionUploadBytes() << " bytes)";
+        ss << " (state calls: " << Utils::OpenGL::stateCache.lastIssuedCalls << " issued, " << Utils::OpenGL::stateCache.lastSkippedCalls << " skipped)";
         glfwSetWindowTitle(ss.str().c_str());
         glfwSetTime(0.0);
         frameCount = 0;
@@ -22,11 +22,15 @@ layout(binding = COLOR_TEXTURE_POSY_3D_BINDING) uniform sampler3D tVoxColorPosY;
 layout(binding = COLOR_TEXTURE_NEGY_3D_BINDING) uniform sampler3D tVoxColorNegY;
 layout(binding = COLOR_TEXTURE_POSZ_3D_BINDING) uniform sampler3D tVoxColorPosZ;
 layout(binding = COLOR_TEXTURE_NEGZ_3D_BINDING) uniform sampler3D tVoxColorNegZ;
+layout(binding = DISTANCE_FIELD_BINDING) uniform sampler3D tDistanceField;
 
 in vec2 vUV;
 
-const int MAX_STEPS = 1000;
-const float STEPSIZE_WRT_TEXEL = 0.3333;  // Cyrill uses 1/3
+// Quality settings, normally set by the QualityPreset this program was compiled with
+#ifndef QUALITY_PRESET
+#define MAX_STEPS 1000
+#define STEPSIZE_WRT_TEXEL 0.3333  // Cyrill uses 1/3
+#endif
 const float TRANSMIT_MIN = 0.05;
 const float TRANSMIT_K = 3.0;
 
@@ -122,6 +126,13 @@ vec4 conetraceAccum(vec3 ro, vec3 rd) {
         col += (1.0-dtm) * sampleAnisotropic(pos, rd, mipLevel).rgb;
     }
 
+    #ifdef DISTANCE_FIELD
+    // skip the empty space the cone can't touch. the cone widens as it moves,
+    // so the free distance is shared between the step and the footprint growth
+    float freeDist = textureLod(tDistanceField, pos, 0.0).r - pixSize;
+    stepSize = max(stepSize, freeDist/(1.0+gPixSizeAtDist));
+    #endif
+
     pos += stepSize*rd;
     
     if (tm < TRANSMIT_MIN ||
@@ -0,0 +1,44 @@
+//---------------------------------------------------------
+// SHADER VARS
+//---------------------------------------------------------
+
+layout (binding = INDIRECT_BINDING) uniform sampler2D indirectTexture;
+layout (binding = NORMAL_DEPTH_BINDING) uniform sampler2D normalDepthTexture;
+layout (location = 0) out vec4 fragColor;
+
+#define FILTER_DEPTH_K 0.05     // relative view depth difference where a neighbour stops counting
+#define FILTER_NORMAL_K 8.0     // falloff exponent for the angle between normals
+
+
+//---------------------------------------------------------
+// PROGRAM
+//---------------------------------------------------------
+
+// Gathers the interleaved cones of neighbouring pixels, skipping
+// neighbours that lie on a different surface.
+void main(void)
+{
+	ivec2 coord = ivec2(gl_FragCoord.xy);
+	ivec2 maxCoord = textureSize(indirectTexture, 0) - 1;
+	vec4 centerNormalDepth = texelFetch(normalDepthTexture, coord, 0);
+
+	// A depth of 0.0 means nothing was drawn
+	if (centerNormalDepth.w == 0.0) {
+		fragColor = vec4(0.0);
+		return;
+	}
+
+	vec4 sum = vec4(0.0);
+	float totalWeight = 0.0;
+	for (int i=-(INTERLEAVE_SIZE-1); i<=INTERLEAVE_SIZE-1; i++) {
+		ivec2 sampleCoord = clamp(coord + ivec2(0, i), ivec2(0), maxCoord);
+		vec4 normalDepth = texelFetch(normalDepthTexture, sampleCoord, 0);
+		float depthWeight = max(1.0 - abs(normalDepth.w - centerNormalDepth.w) / (centerNormalDepth.w*FILTER_DEPTH_K), 0.0);
+		float normalWeight = pow(max(dot(normalDepth.xyz, centerNormalDepth.xyz), 0.0), FILTER_NORMAL_K);
+		float weight = depthWeight * normalWeight;
+		sum += texelFetch(indirectTexture, sampleCoord, 0) * weight;
+		totalWeight += weight;
+	}
+
+	fragColor = totalWeight > 0.0 ? sum / totalWeight : vec4(0.0);
+}
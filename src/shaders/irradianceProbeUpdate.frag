@@ -0,0 +1,135 @@
+//---------------------------------------------------------
+// SHADER CONSTANTS
+//---------------------------------------------------------
+
+#define PI        3.14159265
+#define GOLDEN_ANGLE 2.39996323
+
+#define NUM_PROBE_DIRS 16
+#define STEPSIZE_WRT_TEXEL 0.3333  // Cyril uses 1/3
+#define TRANSMIT_MIN 0.05
+#define TRANSMIT_K  8.0
+
+// L1 spherical harmonics basis constants
+#define SH_Y00 0.282095
+#define SH_Y1  0.488603
+
+
+//---------------------------------------------------------
+// SHADER VARS
+//---------------------------------------------------------
+
+layout(location = 0) out vec4 fragColor;
+
+layout(binding = COLOR_TEXTURE_POSX_3D_BINDING) uniform sampler3D tVoxColorPosX;
+layout(binding = COLOR_TEXTURE_NEGX_3D_BINDING) uniform sampler3D tVoxColorNegX;
+layout(binding = COLOR_TEXTURE_POSY_3D_BINDING) uniform sampler3D tVoxColorPosY;
+layout(binding = COLOR_TEXTURE_NEGY_3D_BINDING) uniform sampler3D tVoxColorNegY;
+layout(binding = COLOR_TEXTURE_POSZ_3D_BINDING) uniform sampler3D tVoxColorPosZ;
+layout(binding = COLOR_TEXTURE_NEGZ_3D_BINDING) uniform sampler3D tVoxColorNegZ;
+
+layout(binding = PROBE_IMAGE_RED_BINDING, rgba16f) writeonly uniform image3D tProbeRed;
+layout(binding = PROBE_IMAGE_GREEN_BINDING, rgba16f) writeonly uniform image3D tProbeGreen;
+layout(binding = PROBE_IMAGE_BLUE_BINDING, rgba16f) writeonly uniform image3D tProbeBlue;
+
+flat in int slice;
+
+float gTexelSize;
+
+
+//---------------------------------------------------------
+// PROGRAM
+//---------------------------------------------------------
+
+vec4 sampleAnisotropic(vec3 pos, vec3 dir, float mipLevel) {
+    vec4 xtexel = dir.x > 0.0 ?
+        textureLod(tVoxColorNegX, pos, mipLevel) :
+        textureLod(tVoxColorPosX, pos, mipLevel);
+
+    vec4 ytexel = dir.y > 0.0 ?
+        textureLod(tVoxColorNegY, pos, mipLevel) :
+        textureLod(tVoxColorPosY, pos, mipLevel);
+
+    vec4 ztexel = dir.z > 0.0 ?
+        textureLod(tVoxColorNegZ, pos, mipLevel) :
+        textureLod(tVoxColorPosZ, pos, mipLevel);
+
+    // get scaling factors for each axis
+    dir = abs(dir);
+
+    return (dir.x*xtexel + dir.y*ytexel + dir.z*ztexel);
+}
+
+vec3 conetraceIndir(vec3 ro, vec3 rd, float fov) {
+    vec3 pos = ro;
+    float dist = 0.0;
+    float pixSizeAtDist = tan(fov);
+
+    vec3 col = vec3(0.0);   // accumulated color
+    float tm = 1.0;         // accumulated transmittance
+
+    while(tm > TRANSMIT_MIN &&
+        pos.x < 1.0 && pos.x > 0.0 &&
+        pos.y < 1.0 && pos.y > 0.0 &&
+        pos.z < 1.0 && pos.z > 0.0) {
+
+        // calc mip size, clamp min to texelsize
+        float pixSize = max(dist*pixSizeAtDist, gTexelSize);
+        float mipLevel = max(log2(pixSize/gTexelSize), 0.0);
+
+        vec4 vocc = sampleAnisotropic(pos, rd, mipLevel);
+        float dtm = exp( -TRANSMIT_K * STEPSIZE_WRT_TEXEL * vocc.a );
+        tm *= dtm;
+        col += vocc.rgb * (1.0-dtm) * tm;
+
+        float stepSize = pixSize * STEPSIZE_WRT_TEXEL;
+        dist += stepSize;
+        pos += stepSize*rd;
+    }
+
+    return col;
+}
+
+// Evenly distributed directions on the sphere
+vec3 sphericalFibonacci(float i, float n) {
+    float cosTheta = 1.0 - (2.0*i + 1.0)/n;
+    float sinTheta = sqrt(max(1.0 - cosTheta*cosTheta, 0.0));
+    float phi = i*GOLDEN_ANGLE;
+    return vec3(cos(phi)*sinTheta, cosTheta, sin(phi)*sinTheta);
+}
+
+void main()
+{
+    ivec3 probeId = ivec3(ivec2(gl_FragCoord.xy), uProbeSlice + slice);
+    if (probeId.z >= uProbeGridRes.z)
+        return;
+
+    // Probes outside the voxel region can't trace anything, so they keep
+    // the light they had when the region last covered them
+    vec3 probeWorld = uProbeGridWorld.xyz + (vec3(probeId)+0.5)*uProbeGridWorld.w;
+    vec3 pos = (probeWorld-uVoxelRegionWorld.xyz)/uVoxelRegionWorld.w;
+    if (any(lessThanEqual(pos, vec3(0.0))) || any(greaterThanEqual(pos, vec3(1.0))))
+        return;
+
+    gTexelSize = 1.0/uVoxelRes;
+    float voxelOffset = gTexelSize*2.5;
+
+    // Project the traced radiance onto L1 spherical harmonics
+    const float FOV = radians(30.0);
+    vec4 shRed = vec4(0.0);
+    vec4 shGreen = vec4(0.0);
+    vec4 shBlue = vec4(0.0);
+    for (int i=0; i<NUM_PROBE_DIRS; i++) {
+        vec3 rd = sphericalFibonacci(float(i), float(NUM_PROBE_DIRS));
+        vec3 radiance = conetraceIndir(pos+rd*voxelOffset, rd, FOV);
+        vec4 basis = vec4(SH_Y00, SH_Y1*rd);
+        shRed += radiance.r * basis;
+        shGreen += radiance.g * basis;
+        shBlue += radiance.b * basis;
+    }
+
+    float weight = 4.0*PI / float(NUM_PROBE_DIRS);
+    imageStore(tProbeRed, probeId, shRed*weight);
+    imageStore(tProbeGreen, probeId, shGreen*weight);
+    imageStore(tProbeBlue, probeId, shBlue*weight);
+}
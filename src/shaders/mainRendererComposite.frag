@@ -0,0 +1,39 @@
+//---------------------------------------------------------
+// SHADER VARS
+//---------------------------------------------------------
+
+layout (binding = DIRECT_LIGHT_BINDING) uniform sampler2D directLight;
+layout (binding = INDIRECT_ALBEDO_BINDING) uniform sampler2D indirectAlbedo;
+layout (binding = INDIRECT_BINDING) uniform sampler2D filteredIndirect;
+layout (binding = REPROJECTED_HISTORY_BINDING) uniform sampler2D reprojectedHistory;
+layout (binding = SPECULAR_BINDING) uniform sampler2D specular;
+
+layout (location = FINAL_COLOR_FBO_BINDING) out vec4 fragColor;
+layout (location = INDIRECT_HISTORY_FBO_BINDING) out vec4 indirectHistoryOut;
+
+#define INDIR_SCALE 10.0
+#define TEMPORAL_ALPHA 0.2      // weight of the current frame's cones in the history
+
+
+//---------------------------------------------------------
+// PROGRAM
+//---------------------------------------------------------
+
+void main(void)
+{
+	ivec2 coord = ivec2(gl_FragCoord.xy);
+
+	// Blend the reconstructed indirect light into the reprojected history
+	vec4 indir = texelFetch(filteredIndirect, coord, 0);
+	vec4 history = texelFetch(reprojectedHistory, coord, 0);
+	if (history.a > 0.0)
+		indir.rgb = mix(history.rgb, indir.rgb, TEMPORAL_ALPHA);
+	indirectHistoryOut = indir;
+
+	// Alpha of the indirect albedo is the specular weight
+	vec4 albedo = texelFetch(indirectAlbedo, coord, 0);
+	vec3 cout = texelFetch(directLight, coord, 0).rgb;
+	cout += indir.rgb * INDIR_SCALE * albedo.rgb;
+	cout += texelFetch(specular, coord, 0).rgb * albedo.a;
+	fragColor = vec4(cout, 1.0);
+}
@@ -10,12 +10,15 @@ in block
 {
     vec3 position;
     vec3 normal;
-    vec3 shadowMapPos;
+    vec3 lightViewPos;
     vec2 uv;
     flat ivec2 propertyIndex;
 } vertexData;
 
-layout(location = 0) out vec4 fragColor;
+layout(location = DIRECT_LIGHT_FBO_BINDING) out vec4 fragColor;
+layout(location = INDIRECT_ALBEDO_FBO_BINDING) out vec4 indirectAlbedoOut;
+layout(location = NORMAL_DEPTH_FBO_BINDING) out vec4 normalDepthOut;
+layout(location = REPROJECTED_HISTORY_FBO_BINDING) out vec4 reprojectedOut;
 
 
 //---------------------------------------------------------
@@ -23,14 +26,10 @@ layout(location = 0) out vec4 fragColor;
 //---------------------------------------------------------
 
 layout(binding = DIFFUSE_TEXTURE_ARRAY_SAMPLER_BINDING) uniform sampler2DArray diffuseTextures[MAX_TEXTURE_ARRAYS];
-layout(binding = SHADOW_MAP_BINDING) uniform sampler2D shadowMap;  
-
+layout(binding = SHADOW_MAP_BINDING) uniform sampler2DArray shadowMap;
+layout(binding = INDIRECT_HISTORY_BINDING) uniform sampler2D indirectHistory;
+layout(binding = NORMAL_DEPTH_HISTORY_BINDING) uniform sampler2D normalDepthHistory;
 layout(binding = COLOR_TEXTURE_POSX_3D_BINDING) uniform sampler3D tVoxColorPosX;
-layout(binding = COLOR_TEXTURE_NEGX_3D_BINDING) uniform sampler3D tVoxColorNegX;
-layout(binding = COLOR_TEXTURE_POSY_3D_BINDING) uniform sampler3D tVoxColorPosY;
-layout(binding = COLOR_TEXTURE_NEGY_3D_BINDING) uniform sampler3D tVoxColorNegY;
-layout(binding = COLOR_TEXTURE_POSZ_3D_BINDING) uniform sampler3D tVoxColorPosZ;
-layout(binding = COLOR_TEXTURE_NEGZ_3D_BINDING) uniform sampler3D tVoxColorNegZ;
 
 struct MeshMaterial
 {
@@ -42,9 +41,9 @@ struct MeshMaterial
     float emission;
 };
 
-layout(std140, binding = MESH_MATERIAL_ARRAY_BINDING) uniform MeshMaterialArray
+layout(std430, binding = MESH_MATERIAL_BUFFER_BINDING) readonly buffer MeshMaterialArray
 {
-    MeshMaterial meshMaterialArray[NUM_MESHES_MAX];
+    MeshMaterial meshMaterialArray[];
 };
 
 
@@ -121,10 +120,23 @@ vec3 getSpecularColor(MeshMaterial material)
         return texture(diffuseTextures[textureId], vec3(vertexData.uv, textureLayer)).rgb;
 }
 
+// Reads the finest cascade that holds the fragment, away from its edge where the
+// blur clamped. Fragments outside every cascade are lit.
 float getVisibility()
 {
-	float fragLightDepth = vertexData.shadowMapPos.z;
-    float shadowMapDepth = texture(shadowMap, vertexData.shadowMapPos.xy).r;
+    float fragLightDepth = vertexData.lightViewPos.z;
+    float margin = float(SHADOW_BLUR_RADIUS) / float(textureSize(shadowMap, 0).x);
+    int cascade = 0;
+    vec2 shadowMapPos;
+    for (; cascade < NUM_SHADOW_CASCADES; cascade++) {
+        shadowMapPos = vertexData.lightViewPos.xy * uShadowCascades[cascade].xy + uShadowCascades[cascade].zw;
+        if (all(greaterThan(shadowMapPos, vec2(margin))) && all(lessThan(shadowMapPos, vec2(1.0 - margin))))
+            break;
+    }
+    if (cascade == NUM_SHADOW_CASCADES)
+        return 1.0;
+
+    float shadowMapDepth = texture(shadowMap, vec3(shadowMapPos, float(cascade))).r;
 
     if(fragLightDepth <= shadowMapDepth)
         return 1.0;
@@ -139,88 +151,48 @@ float getVisibility()
 // SHADER VARS
 //---------------------------------------------------------
 
-#define EPS       0.0001
-#define EPS2      0.05
-#define EPS8      0.00000001
-#define PI        3.14159265
-#define HALFPI    1.57079633
-#define ROOTTWO   1.41421356
-#define ROOTTHREE 1.73205081
-
-#define EQUALS(A,B) ( abs((A)-(B)) < EPS )
-#define EQUALSZERO(A) ( ((A)<EPS) && ((A)>-EPS) )
-
-#define STEPSIZE_WRT_TEXEL 0.3333  // Cyril uses 1/3
-#define TRANSMIT_MIN 0.05
-#define TRANSMIT_K  8.0
-#define INDIR_DIST_K 4.0
-#define INDIR_K 1.5
-#define AO_DIST_K 0.3
-#define JITTER_K 0.025
+// Quality settings, normally set by the QualityPreset this program was compiled with
+#ifndef QUALITY_PRESET
+#define PASS_DIFFUSE
+#define PASS_INDIR
+#define PASS_SPEC
+#endif
+
+#include "coneShadow"
+
+#define HISTORY_DEPTH_K 0.02        // max relative view depth difference to accept history
+#define HISTORY_NORMAL_K 0.9        // min cosine between normals to accept history
 
 vec3 gNormal, gDiffuse, gSpecular;
-float gTexelSize, gRandVal;
 
 
 //---------------------------------------------------------
-// UTILITIES
+// TEMPORAL REPROJECTION
 //---------------------------------------------------------
 
-// http://www.ozone3d.net/blogs/lab/20110427/glsl-random-generator/
-float rand(vec2 n) {
-    return fract(sin(dot(n.xy, vec2(12.9898, 78.233)))* 43758.5453);
-}
-
-// rotate vector a given angle(rads) over a given axis
-// source: http://www.euclideanspace.com/maths/geometry/rotations/conversions/angleToMatrix/index.htm
-vec3 rotate(vec3 vector, float angle, vec3 axis) {
-    float c = cos(angle);
-    float s = sin(angle);
-    float t = 1.0 - c;
-
-    mat3 rot;
-    rot[0][0] = c + axis.x*axis.x*t;
-    rot[1][1] = c + axis.y*axis.y*t;
-    rot[2][2] = c + axis.z*axis.z*t;
-
-    float tmp1 = axis.x*axis.y*t;
-    float tmp2 = axis.z*s;
-    rot[1][0] = tmp1 + tmp2;
-    rot[0][1] = tmp1 - tmp2;
-    tmp1 = axis.x*axis.z*t;
-    tmp2 = axis.y*s;
-    rot[2][0] = tmp1 - tmp2;
-    rot[0][2] = tmp1 + tmp2;
-    tmp1 = axis.y*axis.z*t;
-    tmp2 = axis.x*s;
-    rot[2][1] = tmp1 + tmp2;
-    rot[1][2] = tmp1 - tmp2;
-
-    return rot*vector;
-}
-
-// find a perpendicular vector, non-particular
-// in this case always parallel to xz-plane
-// v has to be normalized
-vec3 findPerpendicular(vec3 v) {
-    // solve: result dot v = 0
-    // so: X*v.x + Y*v.y + Z*v.z = 0
-    // fix y to 0 - parallel to xz-plane
-    // arbitrary fix x to 1.0, but if v.x == 1.0, then fix z
-    // so: v.x + Z*v.z = 0
-
-    // safe method, rely on floating point
-    //vec3 result;
-    //if (EQUALS(abs(v.x),1.0) || EQUALS(abs(v.y),1.0))
-        //result = vec3(0.0, 0.0, 1.0);
-    //else if (EQUALS(abs(v.z),1.0))
-        //result = vec3(1.0, 0.0, 0.0);
-    //else
-        //result = normalize(vec3(1.0, 0.0, -v.x/(v.z+EPS8)));
-    //return result;
-
-    // fast dirty method
-    return normalize( vec3(1.0, 0.0, -v.x/(v.z+EPS8)) );
+// Find last frame's indirect light for this surface. Fails when the surface
+// was off screen, occluded, or a different surface covered the pixel.
+bool getIndirectHistory(vec3 worldPos, out vec4 history) {
+    history = vec4(0.0);
+
+    vec4 prevClipPos = uPrevViewProjection * vec4(worldPos, 1.0);
+    if (prevClipPos.w <= 0.0)
+        return false;
+
+    vec2 prevUV = (prevClipPos.xy / prevClipPos.w) * 0.5 + 0.5;
+    if (any(lessThan(prevUV, vec2(0.0))) || any(greaterThan(prevUV, vec2(1.0))))
+        return false;
+
+    // w holds the view depth, 0.0 means nothing was drawn there
+    vec4 prevNormalDepth = texture(normalDepthHistory, prevUV);
+    float depthDifference = abs(prevNormalDepth.w - prevClipPos.w) / prevClipPos.w;
+    if (prevNormalDepth.w == 0.0 || 
+        depthDifference > HISTORY_DEPTH_K || 
+        dot(prevNormalDepth.xyz, gNormal) < HISTORY_NORMAL_K)
+        return false;
+
+    history = texture(indirectHistory, prevUV);
+    return true;
 }
 
 
@@ -228,105 +200,6 @@ vec3 findPerpendicular(vec3 v) {
 // PROGRAM
 //---------------------------------------------------------
 
-vec4 sampleAnisotropic(vec3 pos, vec3 dir, float mipLevel) {
-    vec4 xtexel = dir.x > 0.0 ? 
-        textureLod(tVoxColorNegX, pos, mipLevel) : 
-        textureLod(tVoxColorPosX, pos, mipLevel);
-    
-    vec4 ytexel = dir.y > 0.0 ? 
-        textureLod(tVoxColorNegY, pos, mipLevel) : 
-        textureLod(tVoxColorPosY, pos, mipLevel);
-    
-    vec4 ztexel = dir.z > 0.0 ? 
-        textureLod(tVoxColorNegZ, pos, mipLevel) : 
-        textureLod(tVoxColorPosZ, pos, mipLevel);
-    
-    // get scaling factors for each axis
-    dir = abs(dir);
-    //dir = dir/( dir.x + dir.y + dir.z);
-    
-    // TODO: correctly weight averaged output color
-    return (dir.x*xtexel + dir.y*ytexel + dir.z*ztexel);
-}
-
-vec3 conetraceSpec(vec3 ro, vec3 rd, float fov) {
-    vec3 pos = ro;
-    float dist = 0.0;
-    float pixSizeAtDist = tan(fov);
-
-    vec3 col = vec3(0.0);   // accumulated color
-    float tm = 1.0;         // accumulated transmittance
-
-    while(tm > TRANSMIT_MIN &&
-        pos.x < 1.0 && pos.x > 0.0 &&
-        pos.y < 1.0 && pos.y > 0.0 &&
-        pos.z < 1.0 && pos.z > 0.0) {
-
-        // calc mip size, clamp min to texelsize
-        float pixSize = max(dist*pixSizeAtDist, gTexelSize);
-        float mipLevel = max(log2(pixSize/gTexelSize), 0.0);
-
-        //float vocc = textureLod(tVoxColorPosX, pos, mipLevel).a;
-        vec4 vocc = sampleAnisotropic(pos, rd, mipLevel);
-        //if(vocc > 0.0) {
-            float dtm = exp( -TRANSMIT_K * STEPSIZE_WRT_TEXEL * vocc.a );
-            tm *= dtm;
-            col += (1.0-dtm) * vocc.rgb * tm * 10.0;
-        //}
-          
-        // increment
-        float stepSize = pixSize * STEPSIZE_WRT_TEXEL;
-        stepSize += gRandVal*pixSize*JITTER_K;
-        dist += stepSize;
-        pos += stepSize*rd;
-    }
-    
-    return col;
-}
-
-vec4 conetraceIndir(vec3 ro, vec3 rd, float fov) {
-    vec3 pos = ro;
-    float dist = 0.0;
-    float pixSizeAtDist = tan(fov);
-
-    vec4 col = vec4(0.0);   // accumulated color
-    float tm = 1.0;         // accumulated transmittance
-
-    while(tm > TRANSMIT_MIN &&
-        pos.x < 1.0 && pos.x > 0.0 &&
-        pos.y < 1.0 && pos.y > 0.0 &&
-        pos.z < 1.0 && pos.z > 0.0) {
-
-        // calc mip size, clamp min to texelsize
-        float pixSize = max(dist*pixSizeAtDist, gTexelSize);
-        float mipLevel = max(log2(pixSize/gTexelSize), 0.0);
-
-        //vec4 vocc = textureLod(tVoxColorPosX, pos, mipLevel);
-        vec4 vocc = sampleAnisotropic(pos, rd, mipLevel);
-        //if(vocc.a > 0.0) {
-            float dtm = exp( -TRANSMIT_K * STEPSIZE_WRT_TEXEL * vocc.a );
-            tm *= dtm;
-
-            // calc local illumination
-            vec3 lightCol = vocc.rgb * (1.0-dtm) * tm;
-            //lightCol *= (INDIR_DIST_K*dist)*(INDIR_DIST_K*dist);
-            col.rgb += lightCol;
-        //}
-
-        // increment
-        float stepSize = pixSize * STEPSIZE_WRT_TEXEL;
-        stepSize += gRandVal*pixSize*JITTER_K;
-        dist += stepSize;
-        pos += stepSize*rd;
-    }
-  
-    // weight AO by distance f(r) = 1/(1+K*r)
-    float visibility = min( tm*(1.0+AO_DIST_K*dist*dist)*5.0, 1.0);
-
-    return vec4(col.rgb, visibility);
-    //return vec4(visibility);
-}
-
 void main()
 {
     // current vertex info
@@ -345,50 +218,30 @@ void main()
     gDiffuse = getDiffuseColor(material).rgb;
     gSpecular = getSpecularColor(material);
 
-    // calc globals
-    gRandVal = 0.0;//rand(pos.xy);
-    gTexelSize = 1.0/uVoxelRes; // size of one texel in normalized texture coords
-    float voxelOffset = gTexelSize*2.5;
-
-    #define PASS_DIFFUSE
-    #define PASS_INDIR
-    #define PASS_SPEC
+    // view depth is the clip space w
+    normalDepthOut = vec4(gNormal, 1.0/gl_FragCoord.w);
+    indirectAlbedoOut = vec4(0.0);
+    reprojectedOut = vec4(0.0);
 
+    // The indirect and specular cones are traced by the cone trace compute pass
+    // after this one. The history it needs is only passed along here.
     #ifdef PASS_INDIR
-    vec4 indir = vec4(0.0);
     {
-        #define NUM_DIRS 4.0
-        const float FOV = radians(45.0);
-        const float NORMAL_ROTATE = radians(45.0);
-        const float ANGLE_ROTATE = 2.0*PI / NUM_DIRS;
-
-        vec3 axis = findPerpendicular(gNormal);
-        for (float i=0.0; i<NUM_DIRS; i++) {
-            vec3 rotatedAxis = rotate(axis, ANGLE_ROTATE*(i+EPS), gNormal);
-            vec3 rd = rotate(gNormal, NORMAL_ROTATE, rotatedAxis);
-            indir += conetraceIndir(pos+rd*voxelOffset, rd, FOV);
-        }
-
-        indir /= NUM_DIRS;
-
-        #undef NUM_DIRS
-    }
-    #endif
-
-    #ifdef PASS_SPEC
-    vec3 spec = vec3(0.0);
-    {    
-        // single cone in reflected eye direction
-        const float FOV = radians(uSpecularFOV);
-        vec3 rd = normalize(worldPos-uCamPos);
-        rd = reflect(rd, gNormal);
-        spec = conetraceSpec(pos+rd*voxelOffset, rd, FOV);
+        // Alpha marks the history as valid
+        vec4 history;
+        bool historyValid = getIndirectHistory(worldPos, history);
+        reprojectedOut = vec4(history.rgb, historyValid ? 1.0 : 0.0);
     }
     #endif
 
     #ifdef PASS_DIFFUSE
 
     float visibility = min(getVisibility(), 1.0);
+    #ifdef CONE_SHADOWS
+    // The shadow map is only used, or even rendered, where there are no voxels
+    if (all(greaterThan(pos, vec3(0.0))) && all(lessThan(pos, vec3(1.0))))
+        visibility = getConeVisibility(tVoxColorPosX, pos, gNormal);
+    #endif
     vec3 view = normalize(worldPos-uCamPos);
     float diffuseTerm = max(dot(uLightDir, gNormal), 0.0);
     cout += gDiffuse.rgb * 0.4 * uLightColor * diffuseTerm * visibility * min(1.0-fade,1.0);
@@ -404,12 +257,19 @@ void main()
     cout += uLightColor * gSpecular * specularTerm * visibility * min(1.0-fade,1.0) * 0.2;
 
     #endif
-    #ifdef PASS_INDIR
-    cout += indir.rgb*10.0*gDiffuse*fade;
-    //cout *= indir.a;
-    #endif
+    // The indirect and specular light are added in the composite pass. Store what
+    // they get multiplied by after the specular and emissive mixes.
+    float indirWeight = 1.0 - material.emission;
+    float specWeight = 0.0;
     #ifdef PASS_SPEC
-    cout = mix(cout, spec*fade, uSpecularAmount);
+    specWeight = indirWeight * uSpecularAmount * fade;
+    cout *= 1.0 - uSpecularAmount;
+    indirWeight *= 1.0 - uSpecularAmount;
+    #endif
+    #ifdef PASS_INDIR
+    indirectAlbedoOut = vec4(gDiffuse*indirWeight, specWeight);
+    #else
+    indirectAlbedoOut = vec4(0.0, 0.0, 0.0, specWeight);
     #endif
 
     // adjust blown out colors
@@ -10,12 +10,12 @@ layout(location = PROPERTY_INDEX_ATTR)  in ivec2 indexes;
 struct ObjectPosition
 {
     mat4 modelMatrix;
+    vec4 vertexDecode; // .xyz scales the mesh's positions, .w is 1 when its normals are octahedral encoded
 };
 
-// Wating to use Shader Storage Buffers so I don't need to statically declare my array size
-layout(std140, binding = POSITION_ARRAY_BINDING) uniform PositionArray
+layout(std430, binding = POSITION_BUFFER_BINDING) readonly buffer PositionArray
 {
-    ObjectPosition positionArray[NUM_OBJECTS_MAX];
+    ObjectPosition positionArray[];
 };
 
 ObjectPosition getObjectPosition()
@@ -36,8 +36,9 @@ out gl_PerVertex
 
 void main()
 {    
-    mat4 modelMatrix = getObjectPosition().modelMatrix; 
-    vec4 worldPosition = modelMatrix * vec4(position, 1.0);
+    ObjectPosition objectPosition = getObjectPosition();
+    mat4 modelMatrix = objectPosition.modelMatrix; 
+    vec4 worldPosition = modelMatrix * vec4(position * objectPosition.vertexDecode.xyz, 1.0);
     gl_Position = uViewProjection * worldPosition;
 }
 
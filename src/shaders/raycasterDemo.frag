@@ -22,13 +22,19 @@ layout(binding = COLOR_TEXTURE_POSY_3D_BINDING) uniform sampler3D tVoxColorPosY;
 layout(binding = COLOR_TEXTURE_NEGY_3D_BINDING) uniform sampler3D tVoxColorNegY;
 layout(binding = COLOR_TEXTURE_POSZ_3D_BINDING) uniform sampler3D tVoxColorPosZ;
 layout(binding = COLOR_TEXTURE_NEGZ_3D_BINDING) uniform sampler3D tVoxColorNegZ;
+layout(binding = DISTANCE_FIELD_BINDING) uniform sampler3D tDistanceField;
 in vec2 vUV;
 
 const uint MAX_STEPS = 64;
+const int MAX_DDA_STEPS = 512;
 const float ALPHA_THRESHOLD = 0.95;
 const float TRANSMIT_MIN = 0.05;
 const float TRANSMIT_K = 8.0;
 
+// Exact voxel traversal instead of fixed step marching. With DISTANCE_FIELD the
+// traversal also sphere traces across empty space, and so do the marching loops.
+#define HIERARCHICAL_DDA
+
 float gStepSize;
 
 // DEBUGTEST: change to uniform later
@@ -96,9 +102,19 @@ bool textureVolumeIntersect(vec3 ro, vec3 rd, out float t) {
     return false;
 }
 
+// step to the next sample
+float nextStepSize(vec3 pos) {
+#ifdef DISTANCE_FIELD
+  // sphere trace over empty space, keeping clear of the footprint of the sampled mip
+  float dist = textureLod(tDistanceField, pos, 0.0).r - exp2(float(uCurrentMipLevel))/uVoxelRes;
+  return max(dist, gStepSize);
+#else
+  return gStepSize;
+#endif
+}
+
 // simple alpha blending
 vec4 raymarchSimple(vec3 ro, vec3 rd) {
-  vec3 step = rd*gStepSize;
   vec3 pos = ro;
   
   vec4 color = vec4(0.0);
@@ -115,7 +131,7 @@ vec4 raymarchSimple(vec3 ro, vec3 rd) {
     color.rgb = EQUALSZERO(color.a) ? vec3(0.0) : 
         (src.rgb*src.a + dst.rgb*dst.a*(1.0-src.a)) / color.a;
 
-    pos += step;
+    pos += rd*nextStepSize(pos);
     
     if (color.a > ALPHA_THRESHOLD ||
       pos.x > 1.0 || pos.x < 0.0 ||
@@ -129,7 +145,6 @@ vec4 raymarchSimple(vec3 ro, vec3 rd) {
 
 // raymarch to get transmittance
 float getTransmittance(vec3 ro, vec3 rd) {
-  vec3 step = rd*gStepSize;
   vec3 pos = ro;
   
   float tm = 1.0;
@@ -137,7 +152,7 @@ float getTransmittance(vec3 ro, vec3 rd) {
   for (int i=0; i<MAX_STEPS; ++i) {
     tm *= exp( -TRANSMIT_K*gStepSize*textureLod(tVoxColorPosX, pos, uCurrentMipLevel).a );
 
-    pos += step;
+    pos += rd*nextStepSize(pos);
     
     if (tm < TRANSMIT_MIN ||
       pos.x > 1.0 || pos.x < 0.0 ||
@@ -152,7 +167,6 @@ float getTransmittance(vec3 ro, vec3 rd) {
 // raymarch transmittance from r0 to r1
 float getTransmittanceToDst(vec3 r0, vec3 r1) {
   vec3 dir = normalize(r1-r0);
-  vec3 step = dir*gStepSize;
   vec3 pos = r0;
   
   float tm = 1.0;
@@ -160,7 +174,7 @@ float getTransmittanceToDst(vec3 r0, vec3 r1) {
   for (int i=0; i<MAX_STEPS; ++i) {
     tm *= exp( -TRANSMIT_K*gStepSize*textureLod(tVoxColorPosX, pos, uCurrentMipLevel).a );
 
-    pos += step;
+    pos += dir*nextStepSize(pos);
 
     // check if pos passed r1
     if ( dot((r1-pos),dir) < 0.0 )
@@ -172,7 +186,6 @@ float getTransmittanceToDst(vec3 r0, vec3 r1) {
 
 // raymarch with light transmittance
 vec4 raymarchLight(vec3 ro, vec3 rd) {
-  vec3 step = rd*gStepSize;
   vec3 pos = ro;
     
   vec3 col = vec3(0.0);   // accumulated color
@@ -196,7 +209,7 @@ vec4 raymarchLight(vec3 ro, vec3 rd) {
       col += (1.0-dtm) * texel.rgb*gLightCol[k] * tm * ltm;
     }
     
-    pos += step;
+    pos += rd*nextStepSize(pos);
     
     if (tm < TRANSMIT_MIN ||
       pos.x > 1.0 || pos.x < 0.0 ||
@@ -209,6 +222,69 @@ vec4 raymarchLight(vec3 ro, vec3 rd) {
   return vec4( alpha==0 ? col : col/alpha , alpha);
 }
 
+// Hierarchical 3D DDA. Walks cell by cell through the current mip level, climbing
+// to coarser levels while cells are empty and descending again when they are occupied.
+// Occupancy is conservative since a coarser texel has alpha if any child does. With
+// the distance field, empty cells are left by whichever of the cell exit and the
+// sphere trace step reaches further.
+vec4 raycastHierarchical(vec3 ro, vec3 rd) {
+    int baseLevel = uCurrentMipLevel;
+    int maxLevel = int(uNumMips) - 1;
+    int level = baseLevel;
+
+    // Distance along the ray to cross one unit of the texture on each axis
+    vec3 invDir = 1.0 / (abs(rd) + EPS*EPS);
+    vec3 exitSide = step(vec3(0.0), rd);
+    vec3 stepDir = exitSide*2.0 - 1.0;
+
+    vec3 col = vec3(0.0);   // accumulated color
+    float tm = 1.0;         // accumulated transmittance
+    float t = 0.0;
+
+    for (int i=0; i<MAX_DDA_STEPS; ++i) {
+        vec3 pos = ro + rd*t;
+        if (any(lessThan(pos, vec3(0.0))) || any(greaterThan(pos, vec3(1.0))))
+            break;
+
+        float res = float(textureSize(tVoxColorPosX, level).x);
+        vec3 cell = clamp(floor(pos*res), vec3(0.0), vec3(res-1.0));
+        vec4 texel = texelFetch(tVoxColorPosX, ivec3(cell), level);
+
+        // Occupied coarse cell, look closer
+        if (texel.a > 0.0 && level > baseLevel) {
+            level--;
+            continue;
+        }
+
+        // Distance to the cell's exit face
+        vec3 tSides = ((cell + exitSide)/res - pos) * stepDir * invDir;
+        float tExit = min(min(tSides.x, tSides.y), tSides.z);
+
+        if (texel.a > 0.0) {
+            // alpha normalized to 1 texel, weight by the length of the ray inside it
+            float dtm = exp( -TRANSMIT_K*texel.a*tExit*res );
+            col += (1.0-dtm) * texel.rgb * tm;
+            tm *= dtm;
+            if (tm < TRANSMIT_MIN || texel.a > ALPHA_THRESHOLD)
+                break;
+        }
+        else {
+            #ifdef DISTANCE_FIELD
+            // keep clear of the footprint of the base level, as nextStepSize does
+            float skip = textureLod(tDistanceField, pos, 0.0).r - exp2(float(baseLevel))/uVoxelRes;
+            tExit = max(tExit, skip);
+            #endif
+            if (level < maxLevel)
+                level++;
+        }
+
+        t += tExit + EPS*0.1/res;
+    }
+
+    float alpha = 1.0-tm;
+    return vec4( alpha==0 ? col : col/alpha , alpha);
+}
+
 void main()
 {
     // DEBUGTEST: manually init lights
@@ -243,10 +319,14 @@ void main()
     // calc entry point
     float t = 0.0;
     if (textureVolumeIntersect(uCamPos, rd, t)) {
+        #ifdef HIERARCHICAL_DDA
+        cout = raycastHierarchical(uCamPos+rd*(t+EPS), rd);
+        #else
         // step_size = root_three / max_steps ; to get through diagonal
         gStepSize = ROOTTHREE / float(MAX_STEPS);
 
         cout = raymarchLight(uCamPos+rd*(t+EPS), rd);
+        #endif
     }
     else {
         cout = vec4(0.0);
@@ -10,12 +10,12 @@ layout(location = PROPERTY_INDEX_ATTR)  in ivec2 indexes;
 struct ObjectPosition
 {
     mat4 modelMatrix;
+    vec4 vertexDecode; // .xyz scales the mesh's positions, .w is 1 when its normals are octahedral encoded
 };
 
-// Wating to use Shader Storage Buffers so I don't need to statically declare my array size
-layout(std140, binding = POSITION_ARRAY_BINDING) uniform PositionArray
+layout(std430, binding = POSITION_BUFFER_BINDING) readonly buffer PositionArray
 {
-    ObjectPosition positionArray[NUM_OBJECTS_MAX];
+    ObjectPosition positionArray[];
 };
 
 ObjectPosition getObjectPosition()
@@ -28,13 +28,15 @@ struct MeshMaterial
 {
     vec4 diffuseColor;
     vec4 specularColor;
-    ivec2 textureLayer;
+    ivec2 diffuseTexture;
+    ivec2 normalTexture;
+    ivec2 specularTexture;
     float emission;
 };
 
-layout(std140, binding = MESH_MATERIAL_ARRAY_BINDING) uniform MeshMaterialArray
+layout(std430, binding = MESH_MATERIAL_BUFFER_BINDING) readonly buffer MeshMaterialArray
 {
-    MeshMaterial meshMaterialArray[NUM_MESHES_MAX];
+    MeshMaterial meshMaterialArray[];
 };
 
 MeshMaterial getMeshMaterial()
@@ -60,10 +62,11 @@ out block
 
 void main()
 {    
-    mat4 modelMatrix = getObjectPosition().modelMatrix; 
-    vec4 worldPosition = modelMatrix * vec4(position, 1.0);
+    ObjectPosition objectPosition = getObjectPosition();
+    mat4 modelMatrix = objectPosition.modelMatrix; 
+    vec4 worldPosition = modelMatrix * vec4(position * objectPosition.vertexDecode.xyz, 1.0);
     vec4 viewPosition = uLightView * worldPosition;
-    gl_Position = uLightProj * viewPosition;
+    gl_Position = uViewProjection * worldPosition;
 
     // If the object is emissive, set is clip space w to 0 so that the vertex will be clipped
     // and so will not be rendered into shadow map
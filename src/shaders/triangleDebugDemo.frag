@@ -10,7 +10,7 @@ in block
 {
     vec3 position;
     vec3 normal;
-    vec3 shadowMapPos;
+    vec3 lightViewPos;
     vec2 uv;
     flat ivec2 propertyIndex;
 } vertexData;
@@ -23,7 +23,7 @@ layout (location = 0, index = 0) out vec4 fragColor;
 //---------------------------------------------------------
 
 layout(binding = DIFFUSE_TEXTURE_ARRAY_SAMPLER_BINDING) uniform sampler2DArray diffuseTextures[MAX_TEXTURE_ARRAYS];
-layout(binding = SHADOW_MAP_BINDING) uniform sampler2D shadowMap; 
+layout(binding = SHADOW_MAP_BINDING) uniform sampler2DArray shadowMap;
 
 struct MeshMaterial
 {
@@ -35,9 +35,9 @@ struct MeshMaterial
     float emission;
 };
 
-layout(std140, binding = MESH_MATERIAL_ARRAY_BINDING) uniform MeshMaterialArray
+layout(std430, binding = MESH_MATERIAL_BUFFER_BINDING) readonly buffer MeshMaterialArray
 {
-    MeshMaterial meshMaterialArray[NUM_MESHES_MAX];
+    MeshMaterial meshMaterialArray[];
 };
 
 
@@ -114,10 +114,23 @@ vec3 getSpecularColor(MeshMaterial material)
         return texture(diffuseTextures[textureId], vec3(vertexData.uv, textureLayer)).rgb;
 }
 
+// Reads the finest cascade that holds the fragment, away from its edge where the
+// blur clamped. Fragments outside every cascade are lit.
 float getVisibility()
 {
-	float fragLightDepth = vertexData.shadowMapPos.z;
-    float shadowMapDepth = texture(shadowMap, vertexData.shadowMapPos.xy).r;
+    float fragLightDepth = vertexData.lightViewPos.z;
+    float margin = float(SHADOW_BLUR_RADIUS) / float(textureSize(shadowMap, 0).x);
+    int cascade = 0;
+    vec2 shadowMapPos;
+    for (; cascade < NUM_SHADOW_CASCADES; cascade++) {
+        shadowMapPos = vertexData.lightViewPos.xy * uShadowCascades[cascade].xy + uShadowCascades[cascade].zw;
+        if (all(greaterThan(shadowMapPos, vec2(margin))) && all(lessThan(shadowMapPos, vec2(1.0 - margin))))
+            break;
+    }
+    if (cascade == NUM_SHADOW_CASCADES)
+        return 1.0;
+
+    float shadowMapDepth = texture(shadowMap, vec3(shadowMapPos, float(cascade))).r;
 
     if(fragLightDepth <= shadowMapDepth)
         return 1.0;
@@ -3,19 +3,19 @@
 //---------------------------------------------------------
 
 layout(location = POSITION_ATTR) in vec3 position;
-layout(location = NORMAL_ATTR) in vec3 normal;
+layout(location = NORMAL_ATTR) in vec3 normal; // .xy is the octahedral normal for compact vertices
 layout(location = UV_ATTR) in vec2 uv;
 layout(location = PROPERTY_INDEX_ATTR)  in ivec2 indexes;
 
 struct ObjectPosition
 {
     mat4 modelMatrix;
+    vec4 vertexDecode; // .xyz scales the mesh's positions, .w is 1 when its normals are octahedral encoded
 };
 
-// Wating to use Shader Storage Buffers so I don't need to statically declare my array size
-layout(std140, binding = POSITION_ARRAY_BINDING) uniform PositionArray
+layout(std430, binding = POSITION_BUFFER_BINDING) readonly buffer PositionArray
 {
-    ObjectPosition positionArray[NUM_OBJECTS_MAX];
+    ObjectPosition positionArray[];
 };
 
 ObjectPosition getObjectPosition()
@@ -33,7 +33,7 @@ out block
 {
     vec3 position;
     vec3 normal;
-    vec3 shadowMapPos;
+    vec3 lightViewPos;
     vec2 uv;
     flat ivec2 propertyIndex;
 } vertexData;
@@ -43,18 +43,30 @@ out block
 // PROGRAM
 //---------------------------------------------------------
 
+vec3 decodeNormal(vec4 vertexDecode)
+{
+    if (vertexDecode.w == 0.0)
+        return normal;
+
+    // Unfold the lower half of the octahedron
+    vec3 n = vec3(normal.xy, 1.0 - abs(normal.x) - abs(normal.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n;
+}
+
 void main()
 {    
-    mat4 modelMatrix = getObjectPosition().modelMatrix; 
-    vec4 worldPosition = modelMatrix * vec4(position, 1.0);
-    vec3 worldNormal = normalize(mat3(modelMatrix) * normal);
+    ObjectPosition objectPosition = getObjectPosition();
+    mat4 modelMatrix = objectPosition.modelMatrix; 
+    vec4 worldPosition = modelMatrix * vec4(position * objectPosition.vertexDecode.xyz, 1.0);
+    vec3 worldNormal = normalize(mat3(modelMatrix) * decodeNormal(objectPosition.vertexDecode));
     gl_Position = uViewProjection * worldPosition;
     
+    // The fragment picks a shadow cascade from the light view position
     vec4 lightViewPos = uLightView * worldPosition;
-    vec4 lightProjPos = uLightProj * lightViewPos;
-    // Offset from NDC to texture space
-    vertexData.shadowMapPos.xy = (lightProjPos.xy / lightProjPos.w) * 0.5 + 0.5;
-    vertexData.shadowMapPos.z = -lightViewPos.z;
+    vertexData.lightViewPos.xy = lightViewPos.xy;
+    vertexData.lightViewPos.z = -lightViewPos.z;
 
     vertexData.position = vec3(worldPosition);
     vertexData.normal = worldNormal;
@@ -10,7 +10,7 @@ in block
 {
     vec3 position;
     vec3 normal;
-    vec3 shadowMapPos;
+    vec3 lightViewPos;
     vec2 uv;
     flat ivec2 propertyIndex;
 } vertexData;
@@ -20,14 +20,9 @@ in block
 //---------------------------------------------------------
 
 layout(binding = DIFFUSE_TEXTURE_ARRAY_SAMPLER_BINDING) uniform sampler2DArray diffuseTextures[MAX_TEXTURE_ARRAYS];
-layout(binding = SHADOW_MAP_BINDING) uniform sampler2D shadowMap;  
 
-layout(binding = COLOR_IMAGE_POSX_3D_BINDING, r32ui) uniform uimage3D tVoxColorPosX;
-layout(binding = COLOR_IMAGE_NEGX_3D_BINDING, r32ui) uniform uimage3D tVoxColorNegX;
-layout(binding = COLOR_IMAGE_POSY_3D_BINDING, r32ui) uniform uimage3D tVoxColorPosY;
-layout(binding = COLOR_IMAGE_NEGY_3D_BINDING, r32ui) uniform uimage3D tVoxColorNegY;
-layout(binding = COLOR_IMAGE_POSZ_3D_BINDING, r32ui) uniform uimage3D tVoxColorPosZ;
-layout(binding = COLOR_IMAGE_NEGZ_3D_BINDING, r32ui) uniform uimage3D tVoxColorNegZ;
+layout(binding = VOXEL_ALBEDO_IMAGE_BINDING, r32ui) uniform uimage3D tVoxAlbedo;
+layout(binding = VOXEL_NORMAL_IMAGE_BINDING, r32ui) uniform uimage3D tVoxNormal; // .a is emission and a fragment count, see averageNormal
 
 struct MeshMaterial
 {
@@ -39,9 +34,9 @@ struct MeshMaterial
     float emission;
 };
 
-layout(std140, binding = MESH_MATERIAL_ARRAY_BINDING) uniform MeshMaterialArray
+layout(std430, binding = MESH_MATERIAL_BUFFER_BINDING) readonly buffer MeshMaterialArray
 {
-    MeshMaterial meshMaterialArray[NUM_MESHES_MAX];
+    MeshMaterial meshMaterialArray[];
 };
 
 //---------------------------------------------------------
@@ -69,19 +64,6 @@ vec4 getDiffuseColor(MeshMaterial material)
     return diffuseColor;
 }
 
-float getVisibility()
-{
-    float fragLightDepth = vertexData.shadowMapPos.z;
-    float shadowMapDepth = texture(shadowMap, vertexData.shadowMapPos.xy).r;
-
-    if(fragLightDepth <= shadowMapDepth)
-        return 1.0;
-
-    // Less darknessFactor means lighter shadows
-    float darknessFactor = 20.0;
-    return clamp(exp(darknessFactor * (shadowMapDepth - fragLightDepth)), 0.0, 1.0);
-}
-
 //---------------------------------------------------------
 // PROGRAM
 //---------------------------------------------------------
@@ -92,34 +74,53 @@ uint packColor(vec4 color)
     return (cb.a << 24U) | (cb.b << 16U) | (cb.g << 8U) | cb.r;
 }
 
+vec4 unpackColor(uint value)
+{
+    return vec4(uvec4(value & 0xFFU, (value >> 8U) & 0xFFU, (value >> 16U) & 0xFFU, value >> 24U));
+}
+
+// normal is in [0, 255], emission in [0, 15] and count in [0, 15]
+uint packNormal(vec3 normal, float emission, uint count)
+{
+    uvec3 cb = uvec3(round(clamp(normal, 0.0, 255.0)));
+    uint alpha = (uint(round(clamp(emission, 0.0, 15.0))) << 4U) | count;
+    return (alpha << 24U) | (cb.b << 16U) | (cb.g << 8U) | cb.r;
+}
+
+// Keeps the moving average of the normal and emission of every fragment in the voxel.
+// The top 4 bits of alpha hold the emission, the bottom 4 the number of fragments averaged
+// so far, which saturates so that later fragments keep a weight of 1/16. Whoever loses the
+// swap folds its fragment into the value that won and tries again.
+void averageNormal(ivec3 coord, vec3 normal, float emission)
+{
+    vec3 fragmentNormal = (normal*0.5 + 0.5)*255.0;
+    float fragmentEmission = emission*15.0;
+
+    uint expected = 0U;
+    uint desired = packNormal(fragmentNormal, fragmentEmission, 1U);
+    uint stored;
+    while ((stored = imageAtomicCompSwap(tVoxNormal, coord, expected, desired)) != expected) {
+        expected = stored;
+        vec4 current = unpackColor(stored);
+        uint alpha = uint(current.a);
+        uint count = alpha & 0xFU;
+        float weight = 1.0/float(count + 1U);
+        vec3 averagedNormal = mix(current.rgb, fragmentNormal, weight);
+        float averagedEmission = mix(float(alpha >> 4U), fragmentEmission, weight);
+        desired = packNormal(averagedNormal, averagedEmission, min(count + 1U, 15U));
+    }
+}
+
 void main()
 {
     MeshMaterial material = getMeshMaterial();
-    
-    float visibility = getVisibility();
     vec4 diffuse = getDiffuseColor(material);
-    float alpha = diffuse.a;
     vec3 normal = normalize(vertexData.normal);
-    float LdotN = max(dot(uLightDir, normal), 0.0);
-    vec3 outColor = diffuse.rgb*uLightColor*visibility*LdotN;
-
-    // If emissive, ignore shading and just draw diffuse color
-    outColor = mix(outColor, diffuse.rgb, material.emission);
 
     vec3 voxelPosTextureSpace = (vertexData.position-uVoxelRegionWorld.xyz)/uVoxelRegionWorld.w;
     ivec3 voxelPosImageCoord = ivec3(voxelPosTextureSpace * uVoxelRes);
 
-    //imageStore(tVoxColorPosX, voxelPosImageCoord, vec4(outColor*max(normal.x, 0.0),  alpha));
-    //imageStore(tVoxColorNegX, voxelPosImageCoord, vec4(outColor*max(-normal.x, 0.0), alpha));
-    //imageStore(tVoxColorPosY, voxelPosImageCoord, vec4(outColor*max(normal.y, 0.0),  alpha));
-    //imageStore(tVoxColorNegY, voxelPosImageCoord, vec4(outColor*max(-normal.y, 0.0), alpha));
-    //imageStore(tVoxColorPosZ, voxelPosImageCoord, vec4(outColor*max(normal.z, 0.0),  alpha));
-    //imageStore(tVoxColorNegZ, voxelPosImageCoord, vec4(outColor*max(-normal.z, 0.0), alpha));
-    
-    imageAtomicMax(tVoxColorPosX, voxelPosImageCoord, packColor(vec4(outColor*max(normal.x, 0.0),  alpha)));
-    imageAtomicMax(tVoxColorNegX, voxelPosImageCoord, packColor(vec4(outColor*max(-normal.x, 0.0), alpha)));
-    imageAtomicMax(tVoxColorPosY, voxelPosImageCoord, packColor(vec4(outColor*max(normal.y, 0.0),  alpha)));
-    imageAtomicMax(tVoxColorNegY, voxelPosImageCoord, packColor(vec4(outColor*max(-normal.y, 0.0), alpha)));
-    imageAtomicMax(tVoxColorPosZ, voxelPosImageCoord, packColor(vec4(outColor*max(normal.z, 0.0),  alpha)));
-    imageAtomicMax(tVoxColorNegZ, voxelPosImageCoord, packColor(vec4(outColor*max(-normal.z, 0.0), alpha)));
+    // Lighting is injected later, so only the surface properties are stored
+    imageAtomicMax(tVoxAlbedo, voxelPosImageCoord, packColor(diffuse));
+    averageNormal(voxelPosImageCoord, normal, material.emission);
 }